@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,42 +17,143 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// binit() sizes the cache from the memory that is free at boot,
+// 1/BCACHEFRAC of it but never fewer than NBUF buffers, nor more
+// than there are blocks on the disk (FSSIZE). Buffers are
+// hashed on (dev, blockno) into buckets with a spin-lock each, which
+// protects the chain and each member's dev, blockno, refcnt and used
+// fields, so lookups of different blocks do not contend. A miss
+// takes bcache.lock, which serializes recycling: a clock hand sweeps
+// all buffers, passing over any used since it last came by, and
+// takes the first idle, clean one it finds. Only a miss inserts into
+// a chain, so a miss that holds bcache.lock and does not find the
+// block in its bucket knows nobody else will add it meanwhile.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "slab.h"
 
-struct {
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;     // serializes misses and the clock hand
+  struct slabcache cache;
+  struct buf *hand;         // clock hand, on the ring through b->next
+  int nbuf;
+  struct bucket *bucket;
+  uint nbucket;             // a power of two
 } bcache;
 
+static struct bucket*
+bbucket(uint dev, uint blockno)
+{
+  return &bcache.bucket[(blockno ^ (dev << 16)) & (bcache.nbucket - 1)];
+}
+
+// Must be called after kinit2(), once all of memory is free.
 void
 binit(void)
 {
-  struct buf *b;
+  struct buf *b, *last;
+  struct bucket *bk;
+  int i, order;
 
   initlock(&bcache.lock, "bcache");
+  slabinit(&bcache.cache, "buf", sizeof(struct buf));
+
+  bcache.nbuf = kfreecount() * (PGSIZE / BCACHEFRAC) / sizeof(struct buf);
+  if(bcache.nbuf > FSSIZE)
+    bcache.nbuf = FSSIZE;
+  if(bcache.nbuf < NBUF)
+    bcache.nbuf = NBUF;
+  bcache.nbucket = 1;
+  while(bcache.nbucket * 4 < bcache.nbuf)
+    bcache.nbucket *= 2;
+  order = 0;
+  while((PGSIZE << order) < bcache.nbucket * sizeof(struct bucket))
+    order++;
+  if((bcache.bucket = (struct bucket*)kallocpages(order)) == 0)
+    panic("binit: buckets");
+  for(bk = bcache.bucket; bk < &bcache.bucket[bcache.nbucket]; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head = 0;
+  }
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // Create the clock ring of buffers. Each starts out holding
+  // block 0 of device -1, which bget() never asks for.
+  bk = bbucket(-1, 0);
+  last = 0;
+  for(i = 0; i < bcache.nbuf; i++){
+    if((b = slaballoc(&bcache.cache)) == 0)
+      panic("binit: bufs");
+    memset(b, 0, sizeof(*b));
+    b->dev = -1;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->hnext = bk->head;
+    bk->head = b;
+    if(last)
+      last->next = b;
+    else
+      bcache.hand = b;
+    last = b;
   }
+  last->next = bcache.hand;
+}
+
+// Look for the block in bk. Caller must hold bk->lock.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Take an idle, clean buffer out of its bucket for reuse.
+// Caller must hold bcache.lock.
+static struct buf*
+bvictim(void)
+{
+  struct buf *b, **pp;
+  struct bucket *bk;
+  int n;
+
+  // Two full turns: the first may only clear used bits.
+  for(n = 0; n < 2 * bcache.nbuf; n++){
+    b = bcache.hand;
+    bcache.hand = b->next;
+    bk = bbucket(b->dev, b->blockno);
+    acquire(&bk->lock);
+    // Even if refcnt==0, B_DIRTY indicates a buffer is in use
+    // because log.c has modified it but not yet committed it.
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      if(b->used)
+        b->used = 0;
+      else {
+        for(pp = &bk->head; *pp != b; pp = &(*pp)->hnext)
+          ;
+        *pp = b->hnext;
+        release(&bk->lock);
+        return b;
+      }
+    }
+    release(&bk->lock);
+  }
+  panic("bget: no buffers");
 }
 
 // Look through buffer cache for block on device dev.
@@ -62,34 +163,90 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  acquire(&bcache.lock);
+  bk = bbucket(dev, blockno);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = blookup(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Not cached. Check again now that no one else can add it,
+  // then recycle an unused buffer.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = blookup(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
   }
-  panic("bget: no buffers");
+  release(&bk->lock);
+
+  b = bvictim();
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  b->used = 0;
+  acquire(&bk->lock);
+  b->hnext = bk->head;
+  bk->head = b;
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Start reading the indicated block into the cache and return
+// without waiting, unless it is cached already. The buffer stays
+// locked until the read completes, so a bread() of the block in
+// the meantime waits for it instead of reading it again.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  bk = bbucket(dev, blockno);
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if(b)
+    return;  // cached, or on its way
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  b->flags |= B_ASYNC;
+  idesubmit(b);
+}
+
+// Called by the disk driver, possibly from an interrupt, when a
+// read started by breadahead() has finished: release the buffer
+// on behalf of the process that started it.
+void
+bdone(struct buf *b)
+{
+  struct bucket *bk;
+
+  b->flags &= ~B_ASYNC;
+  releasesleep(&b->lock);
+
+  bk = bbucket(b->dev, b->blockno);
+  acquire(&bk->lock);
+  if(--b->refcnt == 0)
+    b->used = 1;
+  release(&bk->lock);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -115,30 +272,47 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Start writing b's contents to disk and return without waiting.
+// b must stay locked until bwait(b) says the write is done; in
+// between, the disk may merge it with other queued writes.
+void
+bwritestart(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwritestart");
+  b->flags |= B_DIRTY;
+  idesubmit(b);
+}
+
+// Wait for a write started by bwritestart() to finish.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  idecomplete(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Mark it recently used, so the clock hand passes it over once.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bbucket(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->used = 1;
   }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 //PAGEBREAK!
 // Blank page.
-
@@ -4,11 +4,14 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  int used;          // released since the clock hand last passed
+  struct buf *hnext; // hash chain
+  struct buf *next;  // clock ring of all buffers
   struct buf *qnext; // disk queue
+  uint qtime;        // ticks when queued, for the disk deadline
   uchar data[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // read-ahead; the disk driver releases the buffer
 
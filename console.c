@@ -207,6 +207,7 @@ consoleintr(int (*getc)(void))
 #endif // CS333_P3
 #ifdef PDX_XV6
   int shutdown = FALSE;
+  int dokmemdump = FALSE;
 #endif // PDX_XV6
 
   acquire(&cons.lock);
@@ -253,6 +254,9 @@ consoleintr(int (*getc)(void))
     case C('D'):
       shutdown = TRUE;
       break;
+    case C('K'):  // Free physical memory and object caches.
+      dokmemdump = TRUE;
+      break;
 #endif // PDX_XV6
     default:
       if(c != 0 && input.e-input.r < INPUT_BUF){
@@ -271,6 +275,10 @@ consoleintr(int (*getc)(void))
 #ifdef PDX_XV6
   if (shutdown)
     do_shutdown();
+  if (dokmemdump) {
+    kmemdump();
+    slabdump();
+  }
 #endif // PDX_XV6
   if(doprocdump) {
     procdump();  // now call procdump() wo. cons.lock held
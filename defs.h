@@ -7,6 +7,7 @@ struct proc;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
+struct slabcache;
 struct stat;
 struct superblock;
 struct uproc;
@@ -14,8 +15,12 @@ struct uproc;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadahead(uint, uint);
+void            bdone(struct buf*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritestart(struct buf*);
+void            bwait(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -62,6 +67,8 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idesubmit(struct buf*);
+void            idecomplete(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -71,6 +78,12 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+void            kref(char*);
+char*           kallocpages(int);
+void            kfreepages(char*, int);
+void            kmemdump(void);
+int             krefcount(char*);
+int             kfreecount(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -84,24 +97,38 @@ extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
+#ifdef TICKLESS
+void            lapiconeshot(uint);
+uint            lapicperiodic(void);
+int             lapictickless(void);
+void            lapicwake(int);
+#endif // TICKLESS
 void            microdelay(int);
 
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
+void            begin_opn(int);
 void            end_op();
+int             logopmax(void);
 
 // mp.c
 extern int      ismp;
 void            mpinit(void);
 
+// pcache.c
+void            pcacheinit(void);
+char*           pcacheget(struct inode*, uint, uint);
+void            pcacheinval(struct inode*);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
+void            pipeinit(void);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
@@ -136,6 +163,15 @@ void            printListStats(void);
 #ifdef CS333_P4
 int             setpriority(int pid, int priority);
 int             getpriority(int pid);
+int             ticksleep(int);
+void            tickwakeup(void);
+int             setsched(int prio, int quantum, int budget);
+int             getsched(int prio, int *quantum, int *budget);
+int             quantumexpired(struct proc *);
+#endif
+#ifdef CS333_P6
+int             settickets(int pid, int tickets);
+int             gettickets(int pid);
 #endif
 
 // swtch.S
@@ -156,6 +192,12 @@ void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// slab.c
+void            slabinit(struct slabcache*, char*, uint);
+void*           slaballoc(struct slabcache*);
+void            slabfree(struct slabcache*, void*);
+void            slabdump(void);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -195,8 +237,10 @@ int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             cowfault(pde_t*, uint);
+int             pagefault(struct proc*, uint, uint);
+int             uvmfault(struct proc*, uint, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
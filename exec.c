@@ -15,8 +15,10 @@ exec(char *path, char **argv)
   int i, off;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe;
   struct proghdr ph;
+  struct vmseg seg[NSEG];
+  int nseg;
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
@@ -31,6 +33,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  exe = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -41,8 +44,10 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record where each segment comes from; pagefault() reads
+  // the pages in from ip as the program touches them.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -52,15 +57,22 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz >= KERNBASE)
       goto bad;
-    if(ph.vaddr % PGSIZE != 0)
-      goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.vaddr % PGSIZE != 0 || nseg == NSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].memsz = ph.memsz;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    nseg++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // Keep the reference to ip for paging; drop only the lock.
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
   // Allocate two pages at the next page boundary.
@@ -102,8 +114,16 @@ exec(char *path, char **argv)
   curproc->sz = sz;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
+  memmove(curproc->seg, seg, sizeof(seg));
+  curproc->nseg = nseg;
+  curproc->largeheap = 0;
   switchuvm(curproc);
   freevm(oldpgdir);
+  begin_op();
+  if(curproc->exe)
+    iput(curproc->exe);
+  end_op();
+  curproc->exe = exe;
   return 0;
 
 bad:
@@ -113,5 +133,10 @@ bad:
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
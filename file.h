@@ -14,8 +14,15 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // icache hash chain
+  struct inode *next;  // icache LRU list, while ref is 0
+  struct inode *prev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint ranext;        // block after the last one readi() read
+  uint raend;         // read-ahead issued up to here
+  uint rawin;         // read-ahead window, in blocks
+  int npcache;        // pages of this file in the page cache
 
   short type;         // copy of disk inode
   short major;
@@ -20,6 +20,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
@@ -156,28 +157,36 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// entries. In-memory inodes come from a slab cache and are hashed
+// on (dev, inum). When the last reference goes, iput() keeps a
+// valid entry on an LRU list so the next iget() need not read the
+// i-node again; at most NICACHE such entries are kept, and the
+// least recently used goes first, or earlier if memory runs out.
+// Since ip->ref indicates whether an entry is in use, and ip->dev
+// and ip->inum indicate which i-node an entry holds, one must hold
+// icache.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 64
+#define IHASH(dev, inum) (((dev) ^ (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct slabcache cache;
+  struct inode *hash[NIHASH];
+  struct inode *lru;     // unreferenced entries, most recent first
+  struct inode *lrutail;
+  int nlru;
 } icache;
 
 void
 iinit(int dev)
 {
-  int i = 0;
-
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  slabinit(&icache.cache, "inode", sizeof(struct inode));
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
@@ -236,37 +245,74 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+// Take ip off the LRU list. Caller must hold icache.lock.
+static void
+lruremove(struct inode *ip)
+{
+  if(ip->prev)
+    ip->prev->next = ip->next;
+  else
+    icache.lru = ip->next;
+  if(ip->next)
+    ip->next->prev = ip->prev;
+  else
+    icache.lrutail = ip->prev;
+  icache.nlru--;
+}
+
+// Unhash an unreferenced entry and free it.
+// Caller must hold icache.lock.
+static void
+ifree(struct inode *ip)
+{
+  struct inode **pp;
+
+  pp = &icache.hash[IHASH(ip->dev, ip->inum)];
+  while(*pp != ip)
+    pp = &(*pp)->hnext;
+  *pp = ip->hnext;
+  pcacheinval(ip);
+  slabfree(&icache.cache, ip);
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Allocate a new inode cache entry, recycling unreferenced
+  // ones if memory is short.
+  while((ip = slaballoc(&icache.cache)) == 0){
+    if((ip = icache.lrutail) == 0)
+      panic("iget: no inodes");
+    lruremove(ip);
+    ifree(ip);
+  }
 
-  ip = empty;
+  initsleeplock(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = ip->raend = ip->rawin = 0;
+  ip->npcache = 0;
+  ip->hnext = icache.hash[IHASH(dev, inum)];
+  icache.hash[IHASH(dev, inum)] = ip;
   release(&icache.lock);
 
   return ip;
@@ -323,8 +369,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry
+// moves to the LRU list, or is freed if it is not valid.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -348,7 +394,29 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref > 0){
+    release(&icache.lock);
+    return;
+  }
+  // ip->valid cannot change under us now: changing it
+  // takes ip->lock, and so a reference.
+  if(!ip->valid){
+    ifree(ip);
+    release(&icache.lock);
+    return;
+  }
+  ip->prev = 0;
+  ip->next = icache.lru;
+  if(ip->next)
+    ip->next->prev = ip;
+  else
+    icache.lrutail = ip;
+  icache.lru = ip;
+  if(++icache.nlru > NICACHE){
+    ip = icache.lrutail;
+    lruremove(ip);
+    ifree(ip);
+  }
   release(&icache.lock);
 }
 
@@ -412,6 +480,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcacheinval(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -448,6 +517,39 @@ stati(struct inode *ip, struct stat *st)
 }
 
 //PAGEBREAK!
+// Read-ahead for sequential readers. A read that starts at the
+// block after the previous one continues a sequential run, and
+// each such read doubles the read-ahead window, from RAMIN up to
+// RAMAX blocks; a read that starts anywhere else but the block
+// the previous read ended in resets it. Blocks in the window are
+// queued with breadahead() before readi() waits for the first, so
+// the disk can merge them into a few large reads.
+#define RAMIN  4
+#define RAMAX 32
+
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint first, uint last)
+{
+  uint bn, end;
+
+  if(first == ip->ranext)
+    ip->rawin = ip->rawin ? min(ip->rawin * 2, RAMAX) : RAMIN;
+  else if(first + 1 != ip->ranext){
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = last + 1;
+  if(ip->rawin == 0)
+    return;
+
+  end = min(last + 1 + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  for(bn = (ip->raend > first) ? ip->raend : first; bn < end; bn++)
+    breadahead(ip->dev, bmap(ip, bn));
+  if(end > ip->raend)
+    ip->raend = end;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 int
@@ -466,6 +568,8 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    readahead(ip, off/BSIZE, (off + n - 1)/BSIZE);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -495,6 +599,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  pcacheinval(ip);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
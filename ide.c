@@ -1,8 +1,25 @@
 // Simple PIO-based (non-DMA) IDE driver code.
+//
+// Requests go through a small I/O scheduler before they reach the
+// disk. Pending requests are kept sorted by (dev, blockno) and
+// served in one direction (C-LOOK): the next request is the first
+// one at or past the head's position, wrapping to the lowest when
+// there is none. A request that has waited longer than
+// IDE_DEADLINE ticks is served first, so a stream of nearby
+// requests cannot starve a distant one. When a request starts,
+// the pending requests that follow it on the disk in the same
+// direction are merged into one READ/WRITE MULTIPLE command of up
+// to idemult sectors.
+//
+// idesubmit() queues a request and returns; callers that have
+// several requests to make can submit them all and then wait for
+// each with idecomplete(), so the disk sees them together and can
+// merge them. iderw() does both for a single buf.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "pdx.h"
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
@@ -23,16 +40,26 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+#define IDE_MULT      16   // sectors per READ/WRITE MULTIPLE we ask for
+#define IDE_DEADLINE  (TPS/2)  // ticks a request may wait before it jumps the queue
+
+// idequeue is the list of pending bufs, sorted by (dev, blockno)
+// and linked through qnext. ideactive is the list of bufs the disk
+// is working on now, ideactn long, in disk order.
+// idedev and idepos are where the last command left the head.
+// You must hold idelock while manipulating the queues.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *ideactive;
+static int ideactn;
+static uint idedev, idepos;
+static int idemult[2];  // sectors per multiple command, per disk
 
 static int havedisk1;
-static void idestart(struct buf*);
+static void idestart(void);
 
 // Wait for IDE disk to become ready.
 static int
@@ -47,6 +74,18 @@ idewait(int checkerr)
   return 0;
 }
 
+// Ask disk dev for IDE_MULT sectors per interrupt in READ/WRITE
+// MULTIPLE; fall back to single sectors if it refuses.
+static void
+idesetmult(int dev)
+{
+  idewait(0);
+  outb(0x1f6, 0xe0 | (dev<<4));
+  outb(0x1f2, IDE_MULT);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  idemult[dev] = (idewait(1) < 0) ? 1 : IDE_MULT;
+}
+
 void
 ideinit(void)
 {
@@ -65,35 +104,93 @@ ideinit(void)
     }
   }
 
+  idesetmult(0);
+  if(havedisk1)
+    idesetmult(1);
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Is a before b in disk order?
+static int
+idebefore(struct buf *a, uint dev, uint blockno)
+{
+  return a->dev < dev || (a->dev == dev && a->blockno < blockno);
+}
+
+// Take the next request off idequeue, together with any that can
+// be merged with it, and make them the active list.
+// Caller must hold idelock; idequeue must not be empty.
 static void
-idestart(struct buf *b)
+idenext(void)
 {
-  if(b == 0)
+  struct buf **pp, **old, *b;
+  int spb, max;
+
+  // Oldest request if it is overdue, else the next one at or past
+  // the head, else wrap around to the first.
+  old = &idequeue;
+  for(pp = &idequeue; *pp; pp = &(*pp)->qnext)
+    if((*pp)->qtime < (*old)->qtime)
+      old = pp;
+  if(ticks - (*old)->qtime < IDE_DEADLINE){
+    for(old = &idequeue; *old; old = &(*old)->qnext)
+      if(!idebefore(*old, idedev, idepos))
+        break;
+    if(*old == 0)
+      old = &idequeue;
+  }
+
+  spb = BSIZE/SECTOR_SIZE;
+  max = idemult[(*old)->dev & 1] / spb;
+  if(max < 1)
+    max = 1;
+  ideactive = b = *old;
+  ideactn = 1;
+  *old = b->qnext;
+  while(ideactn < max && *old && (*old)->dev == b->dev &&
+        (*old)->blockno == b->blockno + 1 &&
+        ((*old)->flags & B_DIRTY) == (b->flags & B_DIRTY)){
+    b->qnext = *old;
+    b = *old;
+    *old = b->qnext;
+    ideactn++;
+  }
+  b->qnext = 0;
+  idedev = b->dev;
+  idepos = b->blockno + 1;
+}
+
+// Start the active requests.  Caller must hold idelock.
+static void
+idestart(void)
+{
+  struct buf *b;
+
+  if((b = ideactive) == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  if(b->blockno + ideactn > FSSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  int nsect = ideactn * sector_per_block;
+  int read_cmd = (nsect == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (nsect == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
+  if (nsect > idemult[b->dev & 1] && nsect > 1) panic("idestart");
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsect);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    for(; b; b = b->qnext)
+      outsl(0x1f0, b->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -103,39 +200,48 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *next;
 
-  // First queued buffer is the active request.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if((b = ideactive) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
+  ideactive = 0;
 
   // Read data if needed.
   if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+    for(next = b; next; next = next->qnext)
+      insl(0x1f0, next->data, BSIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Wake processes waiting for these bufs.
+  for(; b; b = next){
+    next = b->qnext;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+    if(b->flags & B_ASYNC)
+      bdone(b);
+  }
 
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  // Start disk on next request in queue.
+  if(idequeue != 0){
+    idenext();
+    idestart();
+  }
 
   release(&idelock);
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
+// Queue a request to sync buf with disk and return without
+// waiting for it; see idecomplete(). b must stay locked until the
+// request completes.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
 void
-iderw(struct buf *b)
+idesubmit(struct buf *b)
 {
   struct buf **pp;
 
@@ -148,21 +254,39 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+  // Insert b into idequeue in disk order.
+  b->qtime = ticks;
+  for(pp=&idequeue; *pp && idebefore(*pp, b->dev, b->blockno); pp=&(*pp)->qnext)  //DOC:insert-queue
     ;
+  b->qnext = *pp;
   *pp = b;
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(ideactive == 0){
+    idenext();
+    idestart();
+  }
 
-  // Wait for request to finish.
+  release(&idelock);
+}
+
+// Wait for a request queued by idesubmit() to finish.
+void
+idecomplete(struct buf *b)
+{
+  acquire(&idelock);
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
-
-
   release(&idelock);
 }
+
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b);
+  idecomplete(b);
+}
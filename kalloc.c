@@ -15,12 +15,46 @@ extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
   struct run *next;
+  struct run *prev;  // buddy free lists only
 };
 
+// The global pool is a binary buddy allocator. A free block of order
+// k is 2^k pages, aligned to its size, and sits on kmem.free[k]; its
+// first page's kmem.border entry holds BFREE|k. Freeing a block merges
+// it with its buddy (the block at pfn ^ 2^k) for as long as the buddy
+// is free too, so large contiguous regions come back together.
+#define MAXORDER 10       // largest block: 4 MB
+#define BFREE    0x80
+#define NPAGE    (PHYSTOP >> PGSHIFT)
+
+// Each CPU keeps a small cache of free pages so that most kalloc()
+// and kfree() calls stay off kmem.lock. A cache is refilled from the
+// buddy pool KBATCH pages at a time when it runs dry, and drains
+// KBATCH pages back once it holds more than KCACHE. The per-cache
+// lock is almost never contended; it is there so that a CPU that
+// finds the pool empty can take pages from its peers.
+#define KCACHE 64
+#define KBATCH 32
+
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+};
+
+// Pages can be shared copy-on-write after fork(), so each physical
+// page has a reference count and kfree() only puts a page back on
+// the free list when its last reference is dropped. At most NPROC
+// processes share a page, so a uchar is plenty. Counts are updated
+// atomically rather than under a lock.
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[MAXORDER+1];
+  int nfree[MAXORDER+1];
+  struct kcache cache[NCPU];
+  uchar border[NPAGE];
+  uchar ref[NPAGE];
 } kmem;
 
 // Initialization happens in two phases.
@@ -28,10 +62,15 @@ struct {
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// The per-CPU caches come into use with the locks, after kinit2().
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.cache[i].lock, "kcache");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -48,32 +87,165 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.ref[V2P(p) >> PGSHIFT] = 1;
     kfree(p);
+  }
+}
+
+// Buddy free list maintenance. Caller must hold kmem.lock
+// (or be booting, before use_lock is set).
+static void
+bpush(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.free[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[order] = r;
+  kmem.nfree[order]++;
+  kmem.border[V2P(r) >> PGSHIFT] = BFREE | order;
+}
+
+static void
+bremove(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[order]--;
+  kmem.border[V2P(r) >> PGSHIFT] = 0;
+}
+
+// Take a block of 2^order pages, splitting a larger one if needed.
+static struct run*
+balloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER && kmem.free[k] == 0; k++)
+    ;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.free[k];
+  bremove(r, k);
+  while(k > order){  // keep the low half, free the high half
+    k--;
+    bpush((struct run*)((char*)r + (PGSIZE << k)), k);
+  }
+  return r;
+}
+
+// Return a block of 2^order pages, merging it with free buddies.
+static void
+bfree(struct run *r, int order)
+{
+  uint pfn, buddy;
+
+  pfn = V2P(r) >> PGSHIFT;
+  for(; order < MAXORDER; order++){
+    buddy = pfn ^ (1 << order);
+    if(buddy >= NPAGE || kmem.border[buddy] != (BFREE | order))
+      break;
+    bremove((struct run*)P2V(buddy << PGSHIFT), order);
+    pfn &= ~(1 << order);
+  }
+  bpush((struct run*)P2V(pfn << PGSHIFT), order);
+}
+
+// Move up to n pages from the buddy pool to kc.
+// Caller must hold kc->lock.
+static void
+krefill(struct kcache *kc, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(n-- > 0 && (r = balloc(0)) != 0){
+    r->next = kc->freelist;
+    kc->freelist = r;
+    kc->nfree++;
+  }
+  release(&kmem.lock);
+}
+
+// Move n pages from kc back to the buddy pool.
+// Caller must hold kc->lock.
+static void
+kdrain(struct kcache *kc, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(n-- > 0 && (r = kc->freelist) != 0){
+    kc->freelist = r->next;
+    kc->nfree--;
+    bfree(r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Pop a page off kc, or return 0 if it is empty.
+static struct run*
+kpop(struct kcache *kc)
+{
+  struct run *r;
+
+  acquire(&kc->lock);
+  if((r = kc->freelist) != 0){
+    kc->freelist = r->next;
+    kc->nfree--;
+  }
+  release(&kc->lock);
+  return r;
 }
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when no references remain.
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *kc;
+  uchar refs;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  refs = __sync_fetch_and_sub(&kmem.ref[V2P(v) >> PGSHIFT], 1);
+  if(refs == 0)
+    panic("kfree: free page");
+  if(refs > 1)
+    return;  // still shared
+
+#ifdef DEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){  // still booting on one CPU
+    bfree(r, 0);
+    return;
+  }
+
+  pushcli();
+  kc = &kmem.cache[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  if(++kc->nfree > KCACHE)
+    kdrain(kc, KBATCH);
+  release(&kc->lock);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +255,115 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *kc;
+  int me, i;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if(!kmem.use_lock){
+    r = balloc(0);
+  } else {
+    pushcli();
+    me = cpuid();
+    kc = &kmem.cache[me];
+    acquire(&kc->lock);
+    if(kc->freelist == 0)
+      krefill(kc, KBATCH);
+    release(&kc->lock);
+    r = kpop(kc);
+    // Pool empty as well: take a page from a peer.
+    for(i = 0; r == 0 && i < NCPU; i++)
+      if(i != me)
+        r = kpop(&kmem.cache[i]);
+    popcli();
+  }
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    kmem.ref[V2P(r) >> PGSHIFT] = 1;
+  return (char*)r;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size, straight from the buddy pool. Returns 0 if no
+// block that large is free. Such blocks are never shared, so
+// they carry no reference count; release them with kfreepages().
+char*
+kallocpages(int order)
+{
+  struct run *r;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  acquire(&kmem.lock);
+  r = balloc(order);
+  release(&kmem.lock);
   return (char*)r;
 }
 
+void
+kfreepages(char *v, int order)
+{
+  if(order < 0 || order > MAXORDER || (uint)v % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > PHYSTOP)
+    panic("kfreepages");
+
+#ifdef DEBUG
+  memset(v, 1, PGSIZE << order);
+#endif
+  acquire(&kmem.lock);
+  bfree((struct run*)v, order);
+  release(&kmem.lock);
+}
+
+// Print the buddy pool's free blocks by order, to show how
+// fragmented physical memory is. Called from the console.
+void
+kmemdump(void)
+{
+  int k, pages = 0, cached = 0, top = -1;
+
+  acquire(&kmem.lock);
+  cprintf("\nFree blocks by order:");
+  for(k = 0; k <= MAXORDER; k++){
+    cprintf(" %d:%d", k, kmem.nfree[k]);
+    pages += kmem.nfree[k] << k;
+    if(kmem.nfree[k])
+      top = k;
+  }
+  release(&kmem.lock);
+  for(k = 0; k < NCPU; k++)
+    cached += kmem.cache[k].nfree;  // unlocked; approximate
+  cprintf("\nFree pages: %d in pool, %d in CPU caches; largest block: order %d\n",
+      pages, cached, top);
+}
+
+// Number of free pages, in the pool and in the CPU caches.
+int
+kfreecount(void)
+{
+  int k, n = 0;
+
+  acquire(&kmem.lock);
+  for(k = 0; k <= MAXORDER; k++)
+    n += kmem.nfree[k] << k;
+  release(&kmem.lock);
+  for(k = 0; k < NCPU; k++)
+    n += kmem.cache[k].nfree;  // unlocked; approximate
+  return n;
+}
+
+// Add a reference to an allocated page, for sharing it
+// copy-on-write.
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kref");
+
+  if(__sync_fetch_and_add(&kmem.ref[V2P(v) >> PGSHIFT], 1) == 0)
+    panic("kref: free page");
+}
+
+// Number of references to an allocated page.
+int
+krefcount(char *v)
+{
+  return *(volatile uchar*)&kmem.ref[V2P(v) >> PGSHIFT];
+}
@@ -43,6 +43,11 @@
 
 volatile uint *lapic;  // Initialized in mp.c
 
+#ifdef PDX_XV6
+#define TICK_COUNT 1000000     // timer counts per clock tick
+#define MAXONESHOT 4000        // ticks; keeps TICR within 32 bits
+#endif // PDX_XV6
+
 //PAGEBREAK!
 static void
 lapicw(int index, int value)
@@ -67,7 +72,7 @@ lapicinit(void)
   lapicw(TDCR, X1);
   lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
 #ifdef PDX_XV6
-  lapicw(TICR, 1000000);
+  lapicw(TICR, TICK_COUNT);
 #else
   lapicw(TICR, 10000000);
 #endif // PDX_XV6
@@ -117,6 +122,56 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+#ifdef TICKLESS
+// Tickless idle support. An idle CPU swaps the periodic tick for a
+// single interrupt n ticks out, and restores the tick when it has
+// work again.
+void
+lapiconeshot(uint n)
+{
+  if(!lapic)
+    return;
+  if(n > MAXONESHOT)
+    n = MAXONESHOT;
+  lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+  lapicw(TICR, n * TICK_COUNT);
+}
+
+// Restore the periodic tick. Returns the whole ticks that passed
+// since lapiconeshot(): the full interval if it fired.
+uint
+lapicperiodic(void)
+{
+  uint n;
+
+  if(!lapic)
+    return 0;
+  n = (lapic[TICR] - lapic[TCCR]) / TICK_COUNT;
+  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, TICK_COUNT);
+  return n;
+}
+
+// Is this CPU's timer in one-shot (tickless) mode?
+int
+lapictickless(void)
+{
+  return lapic && !(lapic[TIMER] & PERIODIC);
+}
+
+// Send the IRQ_WAKE interrupt to the CPU with the given APIC id.
+void
+lapicwake(int apicid)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | (T_IRQ0 + IRQ_WAKE));
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+#endif // TICKLESS
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
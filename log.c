@@ -1,24 +1,39 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
+#include "slab.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. The logging system only closes a transaction when there
+// are no FS system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() reserves MAXOPBLOCKS of log
+// space, or as many as a call to begin_opn() asks for. Usually
+// it just counts the reservation and returns. But if the log
+// could run out, it sleeps until the transaction ahead of it
+// has committed.
+//
+// mkfs sizes the log; the superblock says how large it is.
+//
+// Commits are grouped and overlap with new system calls. The
+// process whose end_op() leaves the open transaction idle commits
+// it: it waits LOGDELAY ticks for more calls to join, closes the
+// transaction, and copies its blocks to snapshot buffers private
+// to the log. Only that copy holds off begin_op(). The snapshot
+// is then written to the log and to the home locations while new
+// calls fill the next transaction in the buffer cache, and the
+// committer goes on to commit that one too if it is ready by then.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -41,14 +56,19 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks they have reserved.
+  int committing;  // someone is in commit().
+  int sealing;     // commit() is closing lh; begin_op() must wait.
   int dev;
-  struct logheader lh;
+  struct logheader lh;      // the open transaction
+  struct logheader clh;     // the one being committed; as on disk
+  struct buf *snap[LOGSIZE]; // clh's blocks as of its commit
+  struct slabcache snapcache;
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void commit(void);
 
 void
 initlog(int dev)
@@ -57,27 +77,47 @@ initlog(int dev)
     panic("initlog: too big logheader");
 
   struct superblock sb;
+  int i;
+
   initlock(&log.lock, "log");
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
+  if (log.size > LOGSIZE + 1)
+    log.size = LOGSIZE + 1;  // more than the header can describe
+  if (log.size < 2*MAXOPBLOCKS + 1)
+    panic("initlog: log too small");
   log.dev = dev;
+
+  slabinit(&log.snapcache, "logsnap", sizeof(struct buf));
+  for (i = 0; i < log.size - 1; i++) {
+    if ((log.snap[i] = slaballoc(&log.snapcache)) == 0)
+      panic("initlog: snapshot");
+    initsleeplock(&log.snap[i]->lock, "logsnap");
+  }
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// Used only by recovery, before any FS system call runs.
 static void
 install_trans(void)
 {
   int tail;
+  struct buf *dbuf[LOGSIZE];
 
-  for (tail = 0; tail < log.lh.n; tail++) {
+  // Queue all the writes before waiting for any, so the disk can
+  // sort and merge them.
+  for (tail = 0; tail < log.clh.n; tail++) {
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+    dbuf[tail] = bread(log.dev, log.clh.block[tail]); // read dst
+    memmove(dbuf[tail]->data, lbuf->data, BSIZE);  // copy block to dst
+    bwritestart(dbuf[tail]);  // write dst to disk
     brelse(lbuf);
-    brelse(dbuf);
+  }
+  for (tail = 0; tail < log.clh.n; tail++) {
+    bwait(dbuf[tail]);
+    brelse(dbuf[tail]);
   }
 }
 
@@ -88,9 +128,9 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.clh.n = lh->n;
+  for (i = 0; i < log.clh.n; i++) {
+    log.clh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -104,9 +144,9 @@ write_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.clh.n;
+  for (i = 0; i < log.clh.n; i++) {
+    hb->block[i] = log.clh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,7 +157,7 @@ recover_from_log(void)
 {
   read_head();
   install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
+  log.clh.n = 0;
   write_head(); // clear the log
 }
 
@@ -125,23 +165,45 @@ recover_from_log(void)
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the start of an FS system call that writes
+// at most n blocks, n <= logopmax().
+void
+begin_opn(int n)
+{
+  if(n > logopmax())
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.sealing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > log.size - 1){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
       release(&log.lock);
       break;
     }
   }
 }
 
+// The most log blocks one FS system call may reserve: half the
+// log, so a large write leaves room for other calls to run.
+int
+logopmax(void)
+{
+  return (log.size - 1) / 2;
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and no other commit is under way.
 void
 end_op(void)
 {
@@ -149,15 +211,15 @@ end_op(void)
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  log.reserved -= myproc()->logres;
+  if(log.outstanding == 0 && !log.committing && log.lh.n > 0){
     do_commit = 1;
     log.committing = 1;
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
+    // and this op's reservation has been released.
+    // commit() may
+    // be waiting for the transaction to drain.
     wakeup(&log);
   }
   release(&log.lock);
@@ -166,44 +228,131 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Give more FS system calls a chance to join the open
+// transaction before it is committed.
 static void
-write_log(void)
+logdelay(void)
+{
+#ifdef CS333_P4
+  ticksleep(LOGDELAY);
+#else
+  uint ticks0 = ticks;
+
+  while(ticks - ticks0 < LOGDELAY)
+    sleep(&ticks, (struct spinlock *)0);
+#endif
+}
+
+// Copy the blocks of the transaction being committed from the
+// cache, where the next transaction may soon change them.
+static void
+snapshot(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  for (tail = 0; tail < log.clh.n; tail++) {
+    struct buf *from = bread(log.dev, log.clh.block[tail]); // cache block
+    memmove(log.snap[tail]->data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
   }
 }
 
+// Write the snapshot to the log if tolog, else to the blocks'
+// home locations. The snapshot buffers are not in the cache, so
+// neither write disturbs the cached copies.
 static void
-commit()
+write_snap(int tolog)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
+  int tail;
+  struct buf *s;
+
+  // Queue all the writes before waiting for any, so the disk can
+  // sort them and merge consecutive blocks.
+  for (tail = 0; tail < log.clh.n; tail++) {
+    s = log.snap[tail];
+    acquiresleep(&s->lock);
+    s->dev = log.dev;
+    s->blockno = tolog ? log.start+tail+1 : log.clh.block[tail];
+    bwritestart(s);
+  }
+  for (tail = 0; tail < log.clh.n; tail++) {
+    bwait(log.snap[tail]);
+    releasesleep(&log.snap[tail]->lock);
+  }
+}
+
+// Let the cache evict the committed blocks again, except those
+// the open transaction has written since.
+static void
+unpin(void)
+{
+  int tail, i;
+
+  for (tail = 0; tail < log.clh.n; tail++) {
+    // Holding the buffer keeps log_write() from adding it to lh
+    // between the check and the update.
+    struct buf *b = bread(log.dev, log.clh.block[tail]);
+    acquire(&log.lock);
+    for (i = 0; i < log.lh.n; i++) {
+      if (log.lh.block[i] == b->blockno)
+        break;
+    }
+    if (i == log.lh.n)
+      b->flags &= ~B_DIRTY;
+    release(&log.lock);
+    brelse(b);
+  }
+}
+
+// Commit the open transaction, and the next one as well if it
+// has no FS system calls left in it by the time this one is done.
+// Caller has set log.committing.
+static void
+commit(void)
+{
+  acquire(&log.lock);
+  do {
+    if(LOGDELAY > 0){
+      release(&log.lock);
+      logdelay();
+      acquire(&log.lock);
+    }
+
+    // Close the open transaction: stop new system calls joining
+    // it and wait for the ones in it to finish.
+    log.sealing = 1;
+    while(log.outstanding > 0)
+      sleep(&log, &log.lock);
+    memmove(&log.clh, &log.lh, sizeof(log.lh));
     log.lh.n = 0;
+    release(&log.lock);
+
+    snapshot();
+    acquire(&log.lock);
+    log.sealing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    write_snap(1);   // Write modified blocks to log
+    write_head();    // Write header to disk -- the real commit
+    write_snap(0);   // Now install writes to home locations
+    log.clh.n = 0;
     write_head();    // Erase the transaction from the log
-  }
+    unpin();
+
+    acquire(&log.lock);
+  } while(log.lh.n > 0 && log.outstanding == 0);
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// commit() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
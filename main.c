@@ -28,11 +28,13 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
-  binit();         // buffer cache
+  pcacheinit();    // executable page cache
   fileinit();      // file table
+  pipeinit();      // pipe cache
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  binit();         // buffer cache, sized from free memory
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -32,11 +32,12 @@ ideintr(void)
   // no-op
 }
 
-// Sync buf with disk.
+// Sync buf with disk. The memory disk is never busy, so the
+// request is done by the time this returns.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
 void
-iderw(struct buf *b)
+idesubmit(struct buf *b)
 {
   uchar *p;
 
@@ -57,4 +58,18 @@ iderw(struct buf *b)
   } else
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
+  if(b->flags & B_ASYNC)
+    bdone(b);
+}
+
+void
+idecomplete(struct buf *b)
+{
+  // no-op
+}
+
+void
+iderw(struct buf *b)
+{
+  idesubmit(b);
 }
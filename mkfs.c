@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE + 1;  // header block and data blocks; see -l
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -76,8 +76,20 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc > 2 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l logblocks] fs.img files...\n");
+    exit(1);
+  }
+  // The kernel needs room for two ops of MAXOPBLOCKS, and the
+  // header block can list at most LOGSIZE blocks.
+  if(nlog < 2*MAXOPBLOCKS + 1 || nlog > LOGSIZE + 1){
+    fprintf(stderr, "mkfs: log must be %d to %d blocks\n",
+            2*MAXOPBLOCKS + 1, LOGSIZE + 1);
     exit(1);
   }
 
@@ -38,6 +38,7 @@
 #define CR0_PG          0x80000000      // Paging
 
 #define CR4_PSE         0x00000010      // Page size extension
+#define CR4_PGE         0x00000080      // Page global enable
 
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
@@ -123,6 +124,8 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define LPGSIZE         0x400000 // bytes mapped by a PTE_PS page directory entry
+#define LPGORDER        10      // log2(LPGSIZE/PGSIZE), for kallocpages()
 
 #define PGSHIFT         12      // log2(PGSIZE)
 #define PTXSHIFT        12      // offset of PTX in a linear address
@@ -130,6 +133,8 @@ struct segdesc {
 
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
+#define LPGROUNDUP(sz)  (((sz)+LPGSIZE-1) & ~(LPGSIZE-1))
+#define LPGROUNDDOWN(a) (((a)) & ~(LPGSIZE-1))
 
 // Page table/directory entry flags.
 #define PTE_P           0x001   // Present
@@ -140,7 +145,14 @@ struct segdesc {
 #define PTE_A           0x020   // Accessed
 #define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_G           0x100   // Global, survives CR3 reloads
 #define PTE_MBZ         0x180   // Bits must be zero
+#define PTE_COW         0x200   // Copy-on-write (software, AVL bit)
+
+// Page fault error code bits (tf->err for T_PGFLT)
+#define FEC_PR          0x1     // Protection violation (else not present)
+#define FEC_WR          0x2     // Caused by a write
+#define FEC_U           0x4     // Occurred in user mode
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
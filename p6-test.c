@@ -0,0 +1,62 @@
+#ifdef CS333_P6
+#include "types.h"
+#include "user.h"
+#include "param.h"
+#include "pdx.h"
+#include "uproc.h"
+
+// Lottery scheduler test. Starts CPU-bound children holding 1x, 2x and
+// 3x BASE_TICKETS, lets them compete for RUN_TICKS and then reports the
+// CPU time each one received. The shares should roughly follow the
+// ticket ratio (17% / 33% / 50%). Run with CPUS=1 for clean numbers.
+
+#define NCHILD 3
+#define BASE_TICKETS 100
+#define RUN_TICKS 3000
+
+int
+main(void)
+{
+  int pid[NCHILD];
+  uint cpu[NCHILD];
+  uint total = 0;
+  struct uproc *table;
+  int i, j, n;
+
+  printf(1, "\n> starting lottery share test\n");
+  for(i = 0; i < NCHILD; i++){
+    pid[i] = fork();
+    if(pid[i] == 0){
+      for(;;)
+        ;  // busywait until killed
+    }
+    if(settickets(pid[i], BASE_TICKETS * (i+1)) < 0)
+      printf(2, "settickets(%d) failed\n", pid[i]);
+  }
+  if(settickets(getpid(), MAXTICKETS) < 0)  // make sure we get to report
+    printf(2, "settickets(%d) failed\n", getpid());
+
+  sleep(RUN_TICKS);
+
+  table = malloc(sizeof(struct uproc) * NPROC);
+  n = getprocs(NPROC, table);
+  for(i = 0; i < NCHILD; i++){
+    cpu[i] = 0;
+    for(j = 0; j < n; j++)
+      if(table[j].pid == pid[i])
+        cpu[i] = table[j].CPU_total_ticks;
+    total += cpu[i];
+  }
+  for(i = 0; i < NCHILD; i++){
+    printf(1, "pid %d: %d tickets (%d), %d cpu ticks (%d%%)\n",
+        pid[i], gettickets(pid[i]), BASE_TICKETS * (i+1), cpu[i],
+        total ? cpu[i] * 100 / total : 0);
+    kill(pid[i]);
+  }
+  while(wait() != -1)
+    ;
+  free(table);
+  printf(1, "\n> lottery share test complete\n");
+  exit();
+}
+#endif
@@ -2,14 +2,18 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NSEG          4  // max demand-paged ELF segments per process
+#define NICACHE      64  // unreferenced inodes kept in the inode cache
+#define MAXOPBLOCKS  10  // max # of blocks an FS op writes, unless it says
+#define LOGSIZE      126  // max data blocks in on-disk log; see mkfs -l
+#define NBUF         (LOGSIZE*2)  // minimum size of disk block cache
+#define BCACHEFRAC   32  // disk block cache gets 1/BCACHEFRAC of free memory
+#ifndef LOGDELAY
+#define LOGDELAY      0  // ticks a commit waits for more FS calls to join
+#endif
 #ifdef PDX_XV6
 #define FSSIZE       2000  // size of file system in blocks
 #else
@@ -0,0 +1,156 @@
+// Page cache for executables.
+//
+// Processes running the same binary should share its program
+// pages rather than each reading a private copy. pagefault() asks
+// pcacheget() for a page's worth of a file, identified by inode,
+// offset and length; the first request reads it, later ones get
+// the same physical page with another reference. Processes map
+// cached pages read-only PTE_COW, so text stays shared forever
+// while the first write to a data page gives that process its own
+// copy (see cowfault()). The cache holds a reference of its own,
+// which is what keeps cowfault() from ever writing a cached page
+// in place.
+//
+// The cache holds at most NPCACHE pages. When it is full a clock
+// hand picks the entry to drop; processes that map the page keep
+// it alive. Writing or truncating a file drops its pages, and so
+// does the inode cache when it frees the in-memory inode, which
+// keeps each inode's count of cached pages (ip->npcache) right.
+// Pages are added only with the inode locked, so a writer, which
+// holds the lock too, can trust a count of zero without taking
+// pcache.lock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCACHE 256
+#define NPHASH   64
+#define PHASH(ip, off) ((((uint)(ip) >> 4) ^ ((off) >> PGSHIFT)) % NPHASH)
+
+struct pcpage {
+  struct inode *ip;
+  uint off;              // file offset, page aligned within the segment
+  uint n;                // bytes of file data; the rest is zero
+  char *page;            // 0 if the entry is unused
+  struct pcpage *next;   // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  struct pcpage *hash[NPHASH];
+  uint hand;             // next entry the clock considers
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Look up a cached page. Caller must hold pcache.lock.
+static struct pcpage*
+pclookup(struct inode *ip, uint off, uint n)
+{
+  struct pcpage *e;
+
+  for(e = pcache.hash[PHASH(ip, off)]; e; e = e->next)
+    if(e->ip == ip && e->off == off && e->n == n)
+      return e;
+  return 0;
+}
+
+// Unhash e and drop the cache's reference to its page.
+// Caller must hold pcache.lock.
+static void
+pcdrop(struct pcpage *e)
+{
+  struct pcpage **pp;
+
+  pp = &pcache.hash[PHASH(e->ip, e->off)];
+  while(*pp != e)
+    pp = &(*pp)->next;
+  *pp = e->next;
+  e->ip->npcache--;
+  kfree(e->page);
+  e->page = 0;
+}
+
+// Return a page holding n bytes of ip at off followed by zeroes,
+// with a reference for the caller, or 0 if the file could not be
+// read or memory is exhausted. ip must not be locked; reading it
+// may sleep.
+char*
+pcacheget(struct inode *ip, uint off, uint n)
+{
+  struct pcpage *e;
+  char *mem;
+
+  acquire(&pcache.lock);
+  if((e = pclookup(ip, off, n)) != 0){
+    kref(e->page);
+    release(&pcache.lock);
+    return e->page;
+  }
+  release(&pcache.lock);
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  ilock(ip);
+  if(readi(ip, mem, off, n) != n){
+    iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+
+  // Still holding ip->lock, so no writer can have changed the
+  // file since readi().
+  acquire(&pcache.lock);
+  if((e = pclookup(ip, off, n)) != 0){
+    // Someone else read it meanwhile; use theirs.
+    kref(e->page);
+    release(&pcache.lock);
+    iunlock(ip);
+    kfree(mem);
+    return e->page;
+  }
+  e = &pcache.page[pcache.hand];
+  pcache.hand = (pcache.hand + 1) % NPCACHE;
+  if(e->page)
+    pcdrop(e);
+  e->ip = ip;
+  e->off = off;
+  e->n = n;
+  e->page = mem;
+  e->next = pcache.hash[PHASH(ip, off)];
+  pcache.hash[PHASH(ip, off)] = e;
+  ip->npcache++;
+  kref(mem);  // one for the cache, one for the caller
+  release(&pcache.lock);
+  iunlock(ip);
+  return mem;
+}
+
+// Drop every cached page of ip, whose contents are about to
+// change or whose in-memory inode is about to be freed. Caller
+// must hold ip->lock, or be the inode cache freeing ip.
+void
+pcacheinval(struct inode *ip)
+{
+  struct pcpage *e;
+
+  if(ip->npcache == 0)
+    return;
+  acquire(&pcache.lock);
+  for(e = pcache.page; e < &pcache.page[NPCACHE] && ip->npcache > 0; e++)
+    if(e->page && e->ip == ip)
+      pcdrop(e);
+  release(&pcache.lock);
+}
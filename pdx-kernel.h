@@ -15,6 +15,15 @@ hlt()
   asm volatile("hlt");
 }
 
+// Enable interrupts and halt with no window in between: sti only
+// takes effect after the following instruction, so an interrupt that
+// is already pending wakes the hlt instead of being taken before it.
+static inline void
+stihlt()
+{
+  asm volatile("sti; hlt");
+}
+
 // atom_inc() necessary for removal of tickslock
 // other atomic ops added for completeness
 static inline void
@@ -23,6 +32,12 @@ atom_inc(volatile int *num)
   asm volatile ( "lock incl %0" : "=m" (*num));
 }
 
+static inline void
+atom_add(volatile int *num, int n)
+{
+  asm volatile ( "lock addl %1, %0" : "+m" (*num) : "ir" (n));
+}
+
 static inline void
 lock_inc(uint* mem)
 {
@@ -30,9 +30,24 @@
 #define max(a, b) ((a) > (b) ? (a) : (b))
 
 #ifdef CS333_P4
-#define MAXPRIO 2
+#ifndef MAXPRIO
+#define MAXPRIO 2   // override with 'make MAXPRIO=n', up to 63
+#endif
+#if MAXPRIO < 0 || MAXPRIO > 63
+#error "MAXPRIO must be between 0 and 63"
+#endif
 #define TICKS_TO_PROMOTE 200
 #define DEFAULT_BUDGET 500
+#ifdef TICKLESS
+#define IDLE_TICKS TPS  // longest an idle CPU other than 0 halts
+#endif
+#elif defined(TICKLESS)
+#error "TICKLESS requires CS333_P4"
+#endif
+
+#ifdef CS333_P6
+#define DEFAULT_TICKETS 10
+#define MAXTICKETS 10000
 #endif
 
 #endif  // PDX_INCLUDE
@@ -35,6 +35,63 @@ struct ptrs {
 };
 #endif
 
+#ifdef CS333_P4
+// Per-CPU run queue: one ready list per priority level, a bitmap of
+// the non-empty levels and a count of everything queued.
+//
+// Locking. ptable.lock covers the process table proper: the UNUSED,
+// EMBRYO and ZOMBIE lists, the sleep queues, the timer wheel, the pid
+// index and parent/child links, so it is taken to sleep, wake, fork,
+// exit and wait, but not to schedule. Each run queue's lock covers
+// its ready lists and, for every process whose p->cpu names that
+// queue, the RUNNABLE and RUNNING states and the priority fields.
+// p->cpu itself only changes with both the old and new queue locks
+// held. The lock is held across swtch(): whoever switches away takes
+// its CPU's queue lock and whatever runs next on that CPU releases it.
+//
+// Lock order: ptable.lock before any run queue lock. Only
+// readyListSteal() and runqLockAll() hold more than one run queue
+// lock, and they take them in CPU order.
+//
+// count may be read without the lock as a load hint, so that idle
+// CPUs can decide there is nothing to run or steal without locking.
+#define NREADYMASK (MAXPRIO/32 + 1)
+struct runq {
+  struct spinlock lock;
+  struct ptrs ready[MAXPRIO+1];
+  uint readymask[NREADYMASK];  // bit i set iff ready[i] is non-empty
+  int count;
+#ifdef TICKLESS
+  int idle;                    // owner is halted in cpuIdle()
+#endif
+};
+
+// The lottery draws from every RUNNABLE process at once, so in P6 all
+// CPUs share the lists and lock of runq[0]; each CPU keeps its own idle
+// flag.
+#ifdef CS333_P6
+#define runqOf(cpu) (&ptable.runq[0])
+#else
+#define runqOf(cpu) (&ptable.runq[cpu])
+#endif
+
+// SLEEPING processes are kept on ptable.sleepq, hashed by wait
+// channel, so wakeup1() only walks the processes that could match.
+#define SLEEPQ_BITS 6
+#define NSLEEPQ (1 << SLEEPQ_BITS)
+
+// Hashed timer wheel for ticksleep(): a sleeper is chained (through
+// p->tnext) on slot deadline % NTIMERQ, and each tick only the current
+// slot is examined.
+#define NTIMERQ 256
+
+// Live processes are also hashed by pid (chained through p->pnext)
+// so kill(), setpriority() and getpriority() need not search every
+// state list. A process is indexed from allocproc() until wait()
+// reaps it.
+#define NPIDQ 64
+#endif
+
 static struct {
   struct spinlock lock;
   struct proc proc[NPROC];
@@ -42,8 +99,20 @@ static struct {
   struct ptrs list[statecount];
  #endif
  #ifdef CS333_P4
- struct ptrs ready[MAXPRIO+1];
+ struct runq runq[NCPU];
+ struct ptrs sleepq[NSLEEPQ];
+ struct proc *timerq[NTIMERQ];
+ uint timerAt;          // ticks value the wheel has been swept up to
+ struct proc *pidq[NPIDQ];
  uint PromoteAtTime;
+ int quantum[MAXPRIO+1];  // time slice per priority level, in ticks
+ int budget[MAXPRIO+1];   // budget per priority level, in ticks
+ uint epoch;            // number of promotions so far
+ #endif
+ #ifdef CS333_P6
+ int tickets[NPROC+1];  // Fenwick tree over RUNNABLE tickets, indexed by slot+1
+ int totalTickets;
+ uint seed;
  #endif
 } ptable;
 
@@ -62,9 +131,44 @@ static void checkProcs(const char *, const char *, int);
 #endif // CS333_P3
 #ifdef CS333_P4
 static void updateBudget(struct proc *);
+static void promote(void);
+static uint curPriority(struct proc *);
+static void prioritySync(struct proc *);
+static struct ptrs* sleepList(void *);
+static void timerAdd(struct proc *);
+static void timerRemove(struct proc *);
+#ifdef TICKLESS
+static uint timerNext(void);
+static void cpuIdle(int);
+static void kick(int);
+static void readyListKick(int);
+#endif
+static struct runq* procRunq(struct proc *);
+static void runqLockAll(void);
+static void runqUnlockAll(void);
+static void readyListWake(struct proc *);
+static void schedFinish(void);
+static void pidAdd(struct proc *);
+static void pidRemove(struct proc *);
+static struct proc* pidLookup(int);
+static int  readyListWaiting(int);
+static void readyListPromote(struct runq *);
+static void readyListAdd(struct proc *);
+static int  readyListRemove(struct proc *);
+#ifndef CS333_P6
+static int  readyLevel(struct runq *, int);
+static int  readyListVictim(int);
+static struct proc* readyListPop(struct runq *);
+static struct proc* readyListSteal(int);
+#endif
 static void printReadyLists();
 static void printReadyList(struct proc *, int);
 #endif // CS333_P4
+#ifdef CS333_P6
+static void lotteryAdd(struct proc *);
+static void lotteryRemove(struct proc *);
+static struct proc* lotteryWinner(void);
+#endif // CS333_P6
 
 static struct proc *initproc;
 
@@ -77,6 +181,10 @@ void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+#ifdef CS333_P4
+  for(int cpu = 0; cpu < NCPU; cpu++)
+    initlock(&ptable.runq[cpu].lock, "runq");
+#endif
 }
 
 // Must be called with interrupts disabled
@@ -159,11 +267,17 @@ allocproc(void)
   stateListAdd(&ptable.list[EMBRYO], p);
 #endif  
   p->pid = nextpid++;
+#ifdef CS333_P4
+  pidAdd(p);
+#endif
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
   acquire(&ptable.lock);
+#ifdef CS333_P4
+    pidRemove(p);
+#endif
 
 #ifdef CS333_P3
 
@@ -235,11 +349,20 @@ userinit(void)
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
+  p->exe = 0;
+  p->nseg = 0;
+  p->largeheap = 0;
 
 #ifdef CS333_P4
   p->priority = MAXPRIO;
+  p->epoch = ptable.epoch;
+  p->cpu = 0;
   ptable.PromoteAtTime = ticks + TICKS_TO_PROMOTE;
 #endif
+#ifdef CS333_P6
+  p->tickets = DEFAULT_TICKETS;
+  ptable.seed = 2463534242U ^ ticks;
+#endif
 
 
   // this assignment to p->state lets other cores
@@ -253,11 +376,13 @@ userinit(void)
     }
     assertState(p, EMBRYO, __FUNCTION__, __LINE__);
 #endif
-  p->state = RUNNABLE;
 #ifdef CS333_P4
-  stateListAdd(&ptable.ready[p->priority],p);
+  readyListWake(p);
 #elif CS333_P3
+  p->state = RUNNABLE;
   stateListAdd(&ptable.list[RUNNABLE],p);
+#else
+  p->state = RUNNABLE;
 #endif
   release(&ptable.lock);
 }
@@ -272,8 +397,11 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Only reserve the address space; pagefault() maps zeroed
+    // pages as they are first touched.
+    if(sz + n < sz || sz + n > KERNBASE)
       return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
@@ -305,6 +433,9 @@ fork(void)
     np->kstack = 0;
 #ifdef CS333_P3
     acquire(&ptable.lock);
+#ifdef CS333_P4
+    pidRemove(np);
+#endif
     if(stateListRemove(&ptable.list[EMBRYO], np)==-1){
       panic("failed to remove from EMBRYO list after kernel stack allocation failure in allocproc()");
     }
@@ -328,6 +459,10 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  np->exe = curproc->exe ? idup(curproc->exe) : 0;
+  np->nseg = curproc->nseg;
+  memmove(np->seg, curproc->seg, sizeof(np->seg));
+  np->largeheap = curproc->largeheap;
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
   np->uid = curproc->uid;
@@ -335,7 +470,11 @@ fork(void)
 
 #ifdef CS333_P4
   np->priority = MAXPRIO;
-  np->budget = DEFAULT_BUDGET;
+  np->epoch = ptable.epoch;
+  np->budget = ptable.budget[MAXPRIO];
+#endif
+#ifdef CS333_P6
+  np->tickets = curproc->tickets;
 #endif
 
   pid = np->pid;
@@ -347,12 +486,17 @@ fork(void)
   }
   assertState(np, EMBRYO, __FUNCTION__, __LINE__);
 #endif
-  np->state = RUNNABLE;
   
 #ifdef CS333_P4
-  stateListAdd(&ptable.ready[np->priority], np);
+  np->sibling = curproc->children;
+  curproc->children = np;
+  np->cpu = cpuid();  // start on the parent's run queue; idle CPUs steal
+  readyListWake(np);
 #elif CS333_P3
+  np->state = RUNNABLE;
   stateListAdd(&ptable.list[RUNNABLE], np);
+#else
+  np->state = RUNNABLE;
 #endif
   release(&ptable.lock);
 
@@ -369,7 +513,6 @@ exit(void)
   struct proc *curproc = myproc();
   struct proc *p;
   int fd;
-  int i;
 
   if(curproc == initproc)
     panic("init exiting");
@@ -384,8 +527,11 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe)
+    iput(curproc->exe);
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
 
   acquire(&ptable.lock);
 
@@ -393,39 +539,19 @@ exit(void)
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
-  for(p=ptable.list[EMBRYO].head;p!=NULL;p=p->next){
-    if(p->parent == curproc){
-      p->parent = initproc;
-    }
-  }
-  for(p=ptable.list[SLEEPING].head;p!=NULL;p=p->next){
-    if(p->parent == curproc){
-      p->parent = initproc;
-    }
-  }
-  for (i = 0; i <= MAXPRIO; i++) {
-    for(p=ptable.ready[i].head;p!=NULL;p=p->next){
-      if(p->parent == curproc){
-        p->parent = initproc;
-      }
-    }
-  }
-  for(p=ptable.list[RUNNING].head;p!=NULL;p=p->next){
-    if(p->parent == curproc){
-      p->parent = initproc;
-    }
-  }
-  for(p=ptable.list[ZOMBIE].head;p!=NULL;p=p->next){
-    if(p->parent == curproc){
-      p->parent = initproc;
+  for(p = curproc->children; p != NULL; p = p->sibling){
+    p->parent = initproc;
+    if(p->state == ZOMBIE)
       wakeup1(initproc);
+    if(p->sibling == NULL){
+      p->sibling = initproc->children;
+      initproc->children = curproc->children;
+      curproc->children = NULL;
+      break;
     }
   }
 
   // Jump into the scheduler, never to return.
-  if (stateListRemove(&ptable.list[RUNNING], curproc) == -1) {
-    panic("failed to remove from RUNNING list in exit()");
-  }
   assertState(curproc, RUNNING, __FUNCTION__, __LINE__);
   curproc->state = ZOMBIE;
   stateListAdd(&ptable.list[ZOMBIE], curproc);
@@ -433,6 +559,8 @@ exit(void)
 #ifdef PDX_XV6
   curproc->sz = 0;
 #endif // PDX_XV6
+  acquire(&runqOf(curproc->cpu)->lock);
+  release(&ptable.lock);
   sched();
   panic("zombie exit");
 }
@@ -457,8 +585,11 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe)
+    iput(curproc->exe);
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
 
   acquire(&ptable.lock);
 
@@ -528,8 +659,11 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe)
+    iput(curproc->exe);
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
 
   acquire(&ptable.lock);
 
@@ -563,44 +697,26 @@ exit(void)
 int
 wait(void)
 {
-  struct proc *p;
+  struct proc *p, **pp;
   int havekids;
   uint pid;
   struct proc *curproc = myproc();
-  int i;
+
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    
-    for(p=ptable.list[EMBRYO].head;p!=NULL;p=p->next){
-      if(p->parent != curproc)
-        continue;
-      havekids = 1;
-    }
-    for(p=ptable.list[SLEEPING].head;p!=NULL;p=p->next){
-      if(p->parent != curproc)
-        continue;
-      havekids = 1;
-    }
-    for (i = 0; i <= MAXPRIO; i++) {
-      for(p=ptable.ready[i].head;p!=NULL;p=p->next){
-        if(p->parent != curproc)
-          continue;
-        havekids = 1;
-      }
-    }
-    for(p=ptable.list[RUNNING].head;p!=NULL;p=p->next){
-      if(p->parent != curproc)
+    // Scan through our children looking for exited ones.
+    havekids = curproc->children != NULL;
+    for(pp = &curproc->children; (p = *pp) != NULL; pp = &p->sibling){
+      if(p->state != ZOMBIE)
         continue;
-      havekids = 1;
-    }
-    for(p=ptable.list[ZOMBIE].head;p!=NULL;p=p->next){
-      if(p->parent != curproc)
-        continue;
-      havekids = 1;
-      
-      // Found one.
+
+      // Found one. Its CPU may still be switching off its stack
+      // and page table; that takes no lock we hold, so it is brief.
+      while(p->oncpu)
+        __sync_synchronize();
+      *pp = p->sibling;
+      p->sibling = NULL;
+      pidRemove(p);
       pid = p->pid;
       kfree(p->kstack);
       p->kstack = 0;
@@ -752,13 +868,75 @@ wait(void)
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
 #ifdef CS333_P4
+// Pick the next process for CPU me and take it off its ready
+// list: the lottery winner in P6, otherwise the head of our
+// highest non-empty ready list. Returns NULL if there is nothing
+// to run; only scheduler() goes on to steal. Caller must hold
+// runqOf(me)->lock.
+static struct proc*
+schedNext(int me)
+{
+  struct proc *p;
+
+#ifdef CS333_P6
+  p = lotteryWinner();
+  if(p != NULL && readyListRemove(p) == -1)
+    panic("failed to remove process we will run from ready list in scheduler()");
+#else
+  p = readyListPop(runqOf(me));
+#endif
+  return p;
+}
+
+// Make p, just returned by schedNext(), the process running on
+// CPU me. The caller then switches to it, still holding
+// runqOf(me)->lock; p releases it.
+static void
+schedDispatch(struct proc *p, int me)
+{
+  mycpu()->proc = p;
+  switchuvm(p);
+
+#ifdef CS333_P6
+  lotteryRemove(p);
+#endif
+  p->cpu = me;
+  p->state = RUNNING;
+  p->oncpu = 1;
+
+#ifdef CS333_P2
+  p->cpu_ticks_in=ticks;
+#endif
+}
+
+// Called on the far side of every swtch() with the run queue lock
+// still held. The process switched away from is now off its kernel
+// stack, and unless it was a zombie we switched to the scheduler
+// from, off its page table too; in that case drop the page table
+// here. wait() frees neither until oncpu is clear.
+static void
+schedFinish(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *prev = c->prev;
+
+  if(prev == NULL)
+    return;
+  c->prev = NULL;
+  if(prev->state == ZOMBIE && c->proc == NULL)
+    switchkvm();
+  __sync_synchronize();
+  prev->oncpu = 0;
+}
+
 void
 scheduler(void)
 {
   struct proc *p;
+  struct runq *rq;
   struct cpu *c = mycpu();
   c->proc = 0;
-  int i;
+  int me = c - cpus;
 
 #ifdef PDX_XV6
   int idle;  // for checking if processor is idle
@@ -771,70 +949,58 @@ scheduler(void)
 #ifdef PDX_XV6
     idle = 1;  // assume idle unless we schedule a process
 #endif // PDX_XV6
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-
-    for (i = MAXPRIO; i >= 0; i--) {
-      p=ptable.ready[i].head;
-      if(p==NULL) continue;
-
-        // Switch to chosen process.  It is the process's job
-        // to release ptable.lock and then reacquire it
-        // before jumping back to us.
+    // Idle CPUs stay off the run queue locks until there is work
+    // for them.
+    if(readyListWaiting(me)){
+      rq = runqOf(me);
+      acquire(&rq->lock);
+      p = schedNext(me);
+#ifndef CS333_P6
+      if(p == NULL){
+        release(&rq->lock);
+        p = readyListSteal(me);  // returns holding rq->lock
+      }
+#endif
+      if(p != NULL){
 #ifdef PDX_XV6
         idle = 0;  // not idle this timeslice
 #endif // PDX_XV6
-        c->proc = p;
-        switchuvm(p);
-        
-        if(stateListRemove(&ptable.ready[p->priority], p)==-1){
-          panic("failed to remove process we will run from ready list in scheduler()");
-        }
-        p->state = RUNNING;
-        stateListAdd(&ptable.list[RUNNING], p);
-
-#ifdef CS333_P2
-        p->cpu_ticks_in=ticks;
-#endif
-        swtch(&(c->scheduler), p->context);
+        do {
+          // Switch to chosen process.  It is the process's job
+          // to release rq->lock and then reacquire it
+          // before jumping back to us. Processes hand the CPU
+          // to each other directly in sched(), so we get it back
+          // only when none was ready.
+          schedDispatch(p, me);
+          swtch(&(c->scheduler), p->context);
+
+          // The last process to run is done running for now.
+          // It should have changed its state before coming back.
+          c->proc = 0;
+          schedFinish();
+
+          // Go straight on to the next process, if one has become
+          // ready, still on the last one's page table: every page
+          // table has the same kernel half, so switching to kpgdir
+          // in between would only cost another TLB flush. That page
+          // table cannot be freed meanwhile: a zombie's was dropped
+          // by schedFinish(), and any other process must run again
+          // before it can exit, which takes rq->lock, held until we
+          // have left its page table.
+        } while((p = schedNext(me)) != NULL);
         switchkvm();
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        break;
-    }
-       if(ticks >= ptable.PromoteAtTime){ //Promotion
-      ptable.PromoteAtTime = ticks + TICKS_TO_PROMOTE;
-      //Promoting RUNNING list
-      for(p=ptable.list[RUNNING].head;p!=NULL;p=p->next){
-        if(p->priority < MAXPRIO) p->priority++;
-      }
-
-      //Promoting RUNNABLE (ready) list
-      for (i = 0; i <= MAXPRIO; i++) {
-        for(p=ptable.ready[i].head;p!=NULL;p=p->next){
-          if(p->priority < MAXPRIO) {
-            if(stateListRemove(&ptable.ready[p->priority], p)==-1){
-              panic("failed to remove from ready list in scheduler P4()");
-            }
-            p->priority++;
-            stateListAdd(&ptable.ready[p->priority],p);          
-          }       
-        }
-      }
-
-      //Promoting SLEEPING list
-      for(p=ptable.list[SLEEPING].head;p!=NULL;p=p->next){
-        if(p->priority < MAXPRIO) p->priority++;
       }
+      release(&rq->lock);
     }
-    release(&ptable.lock);
 #ifdef PDX_XV6
     // if idle, wait for next interrupt
     if (idle) {
+#ifdef TICKLESS
+      cpuIdle(me);
+#else
       sti();
       hlt();
+#endif // TICKLESS
     }
 #endif // PDX_XV6
   }
@@ -961,14 +1127,24 @@ scheduler(void)
 // be proc->intena and proc->ncli, but that would
 // break in the few places where a lock is held but
 // there's no process.
+// In P4 and later, hold only this CPU's run queue lock instead,
+// and switch straight to the next ready process when there is
+// one; the scheduler thread only runs when this CPU is about to
+// go idle.
 void
 sched(void)
 {
   int intena;
   struct proc *p = myproc();
+#ifdef CS333_P4
+  struct proc *q;
 
+  if(!holding(&runqOf(cpuid())->lock))
+    panic("sched runq lock");
+#else
   if(!holding(&ptable.lock))
     panic("sched ptable.lock");
+#endif
   if(mycpu()->ncli != 1)
     panic("sched locks");
   if(p->state == RUNNING)
@@ -980,7 +1156,19 @@ sched(void)
   #endif
 
   intena = mycpu()->intena;
+#ifdef CS333_P4
+  if((q = schedNext(cpuid())) == p)
+    schedDispatch(p, cpuid());  // yield() with nothing else ready
+  else {
+    if(q != NULL)
+      schedDispatch(q, cpuid());
+    mycpu()->prev = p;
+    swtch(&p->context, q ? q->context : mycpu()->scheduler);
+    schedFinish();
+  }
+#else
   swtch(&p->context, mycpu()->scheduler);
+#endif
   mycpu()->intena = intena;
 
 }
@@ -992,11 +1180,8 @@ yield(void)
 {
   struct proc *curproc = myproc();
 
-  acquire(&ptable.lock);  //DOC: yieldlock
+  acquire(&runqOf(curproc->cpu)->lock);  //DOC: yieldlock
 
-  if (stateListRemove(&ptable.list[RUNNING], curproc) == -1) {
-    panic("failed to remove from RUNNING list in yield()");
-  }
   assertState(curproc, RUNNING, __FUNCTION__, __LINE__);
 
   //cprintf("Budget before: %d\n", curproc->budget);
@@ -1005,10 +1190,13 @@ yield(void)
   
   curproc->state = RUNNABLE;
  // cprintf("Moving to RUNNABLE with priority %d\n", curproc->priority);
-  stateListAdd(&ptable.ready[curproc->priority],curproc);
+  readyListAdd(curproc);
+#ifdef CS333_P6
+  lotteryAdd(curproc);
+#endif
   
   sched();
-  release(&ptable.lock);
+  release(&runqOf(curproc->cpu)->lock);  // where we resumed, if stolen
 }
 #elif CS333_P3
 
@@ -1050,8 +1238,14 @@ void
 forkret(void)
 {
   static int first = 1;
+#ifdef CS333_P4
+  // Still holding the run queue lock from whoever switched to us.
+  schedFinish();
+  release(&runqOf(myproc()->cpu)->lock);
+#else
   // Still holding ptable.lock from scheduler.
   release(&ptable.lock);
+#endif
 
   if (first) {
     // Some initialization functions must be run in the context
@@ -1086,11 +1280,10 @@ sleep(void *chan, struct spinlock *lk)
     acquire(&ptable.lock);  //DOC: sleeplock1
     if (lk) release(lk);
   }
-  // Go to sleep.
+  // Go to sleep. A waker needs our run queue lock to make us
+  // RUNNABLE again, so it waits until we are off this CPU.
   p->chan = chan;
-  if (stateListRemove(&ptable.list[RUNNING], p) == -1) {
-    panic("failed to remove from RUNNING list in sleep()");
-  }
+  acquire(&runqOf(p->cpu)->lock);
   assertState(p, RUNNING, __FUNCTION__, __LINE__);
 
   //cprintf("Budget Before (Sleeping): %d\n", p->budget);
@@ -1098,18 +1291,20 @@ sleep(void *chan, struct spinlock *lk)
   //cprintf("Moving from RUNNING to SLEEPING with budget = %d\n", p->budget);
 
   p->state = SLEEPING;
-  stateListAdd(&ptable.list[SLEEPING], p);
+  stateListAdd(sleepList(chan), p);
+  release(&ptable.lock);
 
   sched();
+  release(&runqOf(p->cpu)->lock);
 
   // Tidy up.
   p->chan = 0;
 
   // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
-    if (lk) acquire(lk);
-  }
+  if(lk == &ptable.lock)
+    acquire(&ptable.lock);
+  else if (lk)  //DOC: sleeplock2
+    acquire(lk);
 }
 #elif CS333_P3
 void
@@ -1196,20 +1391,17 @@ wakeup1(void *chan)
 {
   struct proc *p;
   struct proc *nextproc;
-  
-  for(p=ptable.list[SLEEPING].head;p!=NULL;){
+  struct ptrs *list = sleepList(chan);
+
+  // Only sleepers whose chan hashes to the same bucket are candidates.
+  for(p=list->head;p!=NULL;){
     nextproc = p-> next;
-    //cprintf("Curproc state: %s\n",states[p->state]);
     if(p->chan == chan){
-      // Remove from SLEEPING list. What if there are multiple SLEEPING processes?
-      // we want to wake up?
-      if (stateListRemove(&ptable.list[SLEEPING], p) == -1) {
+      if (stateListRemove(list, p) == -1) {
         panic("failed to remove from SLEEPING list in wakeup1()");
       } 
       assertState(p, SLEEPING, __FUNCTION__, __LINE__);
-      p->state = RUNNABLE;
-      stateListAdd(&ptable.ready[p->priority],p);
-
+      readyListWake(p);
     }
     p=nextproc;
   }
@@ -1268,55 +1460,23 @@ int
 kill(int pid)
 {
   struct proc *p;
-  int i;
 
   acquire(&ptable.lock);
-  for(p=ptable.list[EMBRYO].head;p!=NULL;p=p->next){
-    if(p->pid == pid){
-      p->killed = 1;
-      release(&ptable.lock);
-      return 0;
-    }
-  }
-  for(p=ptable.list[SLEEPING].head;p!=NULL;p=p->next){
-    if(p->pid == pid){
-      p->killed = 1;
-      if (stateListRemove(&ptable.list[SLEEPING], p) == -1) {
-        panic("failed to remove from SLEEPING list in kill()");
-      }
-      assertState(p, SLEEPING, __FUNCTION__, __LINE__);
-      p->state = RUNNABLE;
-      stateListAdd(&ptable.ready[p->priority],p);
-      release(&ptable.lock);
-      return 0;
-    }
-  }
-  for (i = 0; i <= MAXPRIO; i++) {
-    for(p=ptable.ready[i].head;p!=NULL;p=p->next){
-      if(p->pid == pid){
-        p->killed = 1;
-        release(&ptable.lock);
-        return 0;
-      }
-    }
-  }
-  for(p=ptable.list[RUNNING].head;p!=NULL;p=p->next){
-    if(p->pid == pid){
-      p->killed = 1;
-      release(&ptable.lock);
-      return 0;
-    }
+  if((p = pidLookup(pid)) == NULL){
+    release(&ptable.lock);
+    return -1;
   }
-  for(p=ptable.list[ZOMBIE].head;p!=NULL;p=p->next){
-    if(p->pid == pid){
-      p->killed = 1;
-      release(&ptable.lock);
-      return 0;
+  p->killed = 1;
+  // Wake process from sleep if necessary.
+  if(p->state == SLEEPING){
+    if (stateListRemove(sleepList(p->chan), p) == -1) {
+      panic("failed to remove from SLEEPING list in kill()");
     }
+    assertState(p, SLEEPING, __FUNCTION__, __LINE__);
+    readyListWake(p);
   }
-  
   release(&ptable.lock);
-  return -1;
+  return 0;
 }
 #elif CS333_P3
 int
@@ -1415,7 +1575,7 @@ procdumpP2P3P4(struct proc *p, char *state_string)
    p->uid,
    p->gid,
    p->parent==NULL?p->pid:p->parent->pid,
-   p->priority,
+   curPriority(p),
    s_start_ticks
    );
   if (ms_start_ticks < 10)  cprintf("0");
@@ -1498,7 +1658,10 @@ getprocs(uint max, struct uproc* table){
       table->uid = p->uid;
       table->gid = p->gid;
       table->ppid = p->parent==NULL?p->pid:p->parent->pid;
-      table->priority = p->priority;
+      table->priority = curPriority(p);
+#ifdef CS333_P6
+      table->tickets = p->tickets;
+#endif
       table->elapsed_ticks = ticks - p->start_ticks;
       table->CPU_total_ticks = p->cpu_ticks_total;
       safestrcpy(table->state,states[p->state],STRMAX);
@@ -1584,15 +1747,33 @@ static void
 initProcessLists()
 {
   int i;
+#if defined(CS333_P4)
+  int cpu;
+#endif
 
   for (i = UNUSED; i <= ZOMBIE; i++) {
     ptable.list[i].head = NULL;
     ptable.list[i].tail = NULL;
   }
 #if defined(CS333_P4)
+  for (cpu = 0; cpu < NCPU; cpu++) {
+    for (i = 0; i <= MAXPRIO; i++) {
+      ptable.runq[cpu].ready[i].head = NULL;
+      ptable.runq[cpu].ready[i].tail = NULL;
+    }
+    for (i = 0; i < NREADYMASK; i++)
+      ptable.runq[cpu].readymask[i] = 0;
+    ptable.runq[cpu].count = 0;
+  }
+  for (i = 0; i < NSLEEPQ; i++) {
+    ptable.sleepq[i].head = NULL;
+    ptable.sleepq[i].tail = NULL;
+  }
+  for (i = 0; i < NTIMERQ; i++)
+    ptable.timerq[i] = NULL;
   for (i = 0; i <= MAXPRIO; i++) {
-    ptable.ready[i].head = NULL;
-    ptable.ready[i].tail = NULL;
+    ptable.quantum[i] = SCHED_INTERVAL;
+    ptable.budget[i] = DEFAULT_BUDGET;
   }
 #endif
 }
@@ -1632,8 +1813,10 @@ assertState(struct proc *p, enum procstate state, const char * func, int line)
 void
 printList(int state)
 {
-  int count = 0;
+  int i, count = 0;
   struct proc *p;
+  struct ptrs *lists;
+  int nlists = 1;
   static char *stateNames[] = {  // note: sparse array
     [RUNNABLE]  "Runnable",
     [SLEEPING]  "Sleep",
@@ -1649,36 +1832,70 @@ printList(int state)
   }
 
   acquire(&ptable.lock);
+#ifdef CS333_P4
+  runqLockAll();
+#endif
 #ifdef DEBUG
   checkProcs(__FILE__, __FUNCTION__, __LINE__);
 #endif
 #ifdef CS333_P4
   if (state == RUNNABLE) {
     printReadyLists();
+    runqUnlockAll();
     release(&ptable.lock);
     cprintf("$ ");  // simulate shell prompt
     return;
   }
+  if (state == RUNNING) {  // not listed; each CPU knows what it runs
+    cprintf("\n%s List Processes:\n", stateNames[state]);
+    for (i = 0; i < ncpu; i++) {
+      p = cpus[i].proc;
+      if (p == NULL || p->state != RUNNING)  // idle, or switching away
+        continue;
+      if (count > 0)
+        cprintf(" -> ");
+      cprintf("%d", p->pid);
+      count++;
+    }
+    runqUnlockAll();
+    release(&ptable.lock);
+    cprintf("%s$ ", (count > 0) ? "\n" : "");  // simulate shell prompt
+    return;
+  }
+#endif
+  lists = &ptable.list[state];
+#ifdef CS333_P4
+  if (state == SLEEPING) {  // one list per wait-channel bucket
+    lists = ptable.sleepq;
+    nlists = NSLEEPQ;
+  }
 #endif
   cprintf("\n%s List Processes:\n", stateNames[state]);
-  p = ptable.list[state].head;
-  while (p != NULL) {
-    if (p->state != state) {  // sanity check
-      cprintf("Error: PID %d on %s list but should be on %s\n",
-          p->pid, states[p->state], states[state]);
-      panic("Corrupted list\n");
+  for (i = 0; i < nlists; i++) {
+    for (p = lists[i].head; p != NULL; p = p->next) {
+      if (p->state != state) {  // sanity check
+        cprintf("Error: PID %d on %s list but should be on %s\n",
+            p->pid, states[p->state], states[state]);
+        panic("Corrupted list\n");
+      }
+      if (count > 0) {
+        cprintf(" -> ");
+        if (count % ((state == ZOMBIE) ? PER_LINE_Z : PER_LINE) == 0)
+          cprintf("\n");
+      }
+      if (state == ZOMBIE)
+        cprintf("(%d, %d)", p->pid,
+            (p->parent) ? p->parent->pid : p->pid);
+      else
+        cprintf("%d", p->pid);
+      count++;
     }
-    if (state == ZOMBIE)
-      cprintf("(%d, %d)", p->pid,
-          (p->parent) ? p->parent->pid : p->pid);
-    else
-      cprintf("%d", p->pid);
-    p = p->next;
-    cprintf("%s", p ? " -> " : "\n");
-    if (p && (++count) %
-        ((state == ZOMBIE) ? PER_LINE_Z : PER_LINE) == 0)
-      cprintf("\n");
   }
+  if (count > 0)
+    cprintf("\n");
+#ifdef CS333_P4
+  runqUnlockAll();
+#endif
   release(&ptable.lock);
   cprintf("$ ");  // simulate shell prompt
   return;
@@ -1705,26 +1922,52 @@ printFreeList(void)
 void
 printListStats()
 {
-  int i, count, total = 0;
+  int i, j, count, total = 0;
   struct proc *p;
+  struct ptrs *lists;
+  int nlists;
 
   acquire(&ptable.lock);
+#ifdef CS333_P4
+  runqLockAll();
+#endif
   for (i=UNUSED; i<=ZOMBIE; i++) {
     count = 0;
-    p = ptable.list[i].head;
-    while (p != NULL) {
-      count++;
-      if(p->state != i) {
-        cprintf("\nlist invariant failed: process %d has state %s but is on list %s\n",
-            p->pid, states[p->state], states[i]);
+    lists = &ptable.list[i];
+    nlists = 1;
+#ifdef CS333_P4
+    if (i == SLEEPING) {
+      lists = ptable.sleepq;
+      nlists = NSLEEPQ;
+    }
+    if (i == RUNNABLE) {  // per-CPU ready lists keep their own counts
+      for (j = 0; j < ncpu; j++)
+        if (runqOf(j) == &ptable.runq[j])
+          count += ptable.runq[j].count;
+    }
+    if (i == RUNNING) {
+      for (j = 0; j < ncpu; j++)
+        if (cpus[j].proc != NULL && cpus[j].proc->state == RUNNING)
+          count++;
+    }
+#endif
+    for (j = 0; j < nlists; j++) {
+      for (p = lists[j].head; p != NULL; p = p->next) {
+        count++;
+        if(p->state != i) {
+          cprintf("\nlist invariant failed: process %d has state %s but is on list %s\n",
+              p->pid, states[p->state], states[i]);
+        }
       }
-      p = p->next;
     }
     cprintf("\n%s list has ", states[i]);
     if (count < 10) cprintf(" ");  // line up columns. we know NPROC < 100
     cprintf("%d processes", count);
     total += count;
   }
+#ifdef CS333_P4
+  runqUnlockAll();
+#endif
   release(&ptable.lock);
   cprintf("\nTotal on lists is: %d. NPROC = %d. %s",
       total, NPROC, (total == NPROC) ? "Congratulations!" : "Bummer");
@@ -1738,64 +1981,77 @@ int
 setpriority(int pid, int priority)
 {
   struct proc *p;
-  for(p=ptable.list[SLEEPING].head;p!=NULL;p=p->next){
-    if(p->pid == pid)
-    {
-      p->priority = priority;
-      p->budget = DEFAULT_BUDGET;
-      return 0;
-    }
+  struct runq *rq;
+
+  acquire(&ptable.lock);
+  p = pidLookup(pid);
+  if(p == NULL || p->state == EMBRYO || p->state == ZOMBIE){
+    release(&ptable.lock);
+    return -1;
   }
-  for (int i = 0; i <= MAXPRIO; i++) {
-    for(p=ptable.ready[i].head;p!=NULL;p=p->next){
-      if(p->pid == pid)
-      {
-      if(p->priority != priority){
-          acquire(&ptable.lock);  
-          if(stateListRemove(&ptable.ready[p->priority], p)==-1){
-            panic("failed to remove process we will run from ready list in scheduler()");
-          }
-          p->priority = priority;
-          p->budget = DEFAULT_BUDGET;
-          stateListAdd(&ptable.ready[p->priority],p);
-          release(&ptable.lock);  
-  }
-        return 0;
+  rq = procRunq(p);
+  if(p->state == RUNNABLE){
+    if(curPriority(p) != priority){
+      if(readyListRemove(p)==-1){
+        panic("failed to remove from ready list in setpriority()");
       }
-    }
-  }
-  for(p=ptable.list[RUNNING].head;p!=NULL;p=p->next){
-    if(p->pid == pid)
-    {
       p->priority = priority;
-      p->budget = DEFAULT_BUDGET;
-      return 0;
+      p->epoch = ptable.epoch;
+      p->budget = ptable.budget[priority];
+      readyListAdd(p);
     }
+  } else {
+    p->priority = priority;
+    p->epoch = ptable.epoch;
+    p->budget = ptable.budget[priority];
   }
-  return -1;
+  release(&rq->lock);
+  release(&ptable.lock);
+  return 0;
+}
+
+// Set the time slice and budget for priority level prio. Takes
+// effect at each process's next dispatch or demotion.
+int
+setsched(int prio, int quantum, int budget)
+{
+  acquire(&ptable.lock);
+  ptable.quantum[prio] = quantum;
+  ptable.budget[prio] = budget;
+  release(&ptable.lock);
+  return 0;
 }
+
+int
+getsched(int prio, int *quantum, int *budget)
+{
+  acquire(&ptable.lock);
+  *quantum = ptable.quantum[prio];
+  *budget = ptable.budget[prio];
+  release(&ptable.lock);
+  return 0;
+}
+
+// Has p used up the time slice for its priority level? Called from
+// the timer interrupt without ptable.lock; a stale priority only
+// shifts one slice boundary.
+int
+quantumexpired(struct proc *p)
+{
+  return ticks - p->cpu_ticks_in >= ptable.quantum[curPriority(p)];
+}
+
 int
 getpriority(int pid)
 {
   struct proc *p;
-  for(p=ptable.list[EMBRYO].head;p!=NULL;p=p->next){
-    if(p->pid == pid)return p->priority;
-  }
-  for(p=ptable.list[SLEEPING].head;p!=NULL;p=p->next){
-    if(p->pid == pid)return p->priority;
-  }
-  for (int i = 0; i <= MAXPRIO; i++) {
-    for(p=ptable.ready[i].head;p!=NULL;p=p->next){
-      if(p->pid == pid)return p->priority;
-    }
-  }
-  for(p=ptable.list[RUNNING].head;p!=NULL;p=p->next){
-    if(p->pid == pid)return p->priority;
-  }
-  for(p=ptable.list[ZOMBIE].head;p!=NULL;p=p->next){
-    if(p->pid == pid)return p->priority;
-  }
-  return -1; //invalid pid
+  int rc = -1; //invalid pid
+
+  acquire(&ptable.lock);
+  if((p = pidLookup(pid)) != NULL)
+    rc = curPriority(p);
+  release(&ptable.lock);
+  return rc;
 }
 
 void
@@ -1814,9 +2070,9 @@ printReadyList(struct proc *p, int prio)
   int count = 0;
   do {
     cprintf("(%d, %d)", p->pid, p->budget);
-    if(p->priority != prio) {
+    if(curPriority(p) != prio) {
       cprintf("\nlist invariant failed: process %d has prio %d but is on runnable list %d\n",
-          p->pid, p->priority, prio);
+          p->pid, curPriority(p), prio);
     }
     p = p->next;
     cprintf("%s", p ? " -> " : "\n");
@@ -1831,25 +2087,600 @@ printReadyLists()
   struct proc *p;
 
   cprintf("Ready List Processes:\n");
-  for (int i=MAXPRIO; i>=0; i--) {
-    p = ptable.ready[i].head;
-    cprintf("%d: ", i);
-    printReadyList(p, i);
+  for (int cpu=0; cpu<ncpu; cpu++) {
+    if (runqOf(cpu) != &ptable.runq[cpu])  // shared with cpu0
+      continue;
+    cprintf("cpu%d (%d queued):\n", cpu, ptable.runq[cpu].count);
+    for (int i=MAXPRIO; i>=0; i--) {
+      p = ptable.runq[cpu].ready[i].head;
+      cprintf("%d: ", i);
+      printReadyList(p, i);
+    }
   }
 }
 
 void 
 updateBudget(struct proc *p)
 {
+  prioritySync(p);
   p->budget = p->budget - (ticks-p->cpu_ticks_in);
   if(p->budget <= 0) //Demotion
   {
    if(p->priority > 0) p->priority--;
-   p->budget = DEFAULT_BUDGET;
+   p->budget = ptable.budget[p->priority];
+  }
+}
+
+// Periodic promotion: move every process up one priority level.
+// Rather than touching each process, bump ptable.epoch and let
+// curPriority() apply the missed boosts when a priority is next
+// needed. Ready lists are shifted up a level wholesale so they stay
+// in step, which costs O(MAXPRIO) per CPU however many processes are
+// queued. Every run queue is locked so that no queue sees the new
+// epoch before its lists have moved. Caller must hold ptable.lock.
+static void
+promote(void)
+{
+  int cpu;
+
+  ptable.PromoteAtTime = ticks + TICKS_TO_PROMOTE;
+  runqLockAll();
+  ptable.epoch++;
+  for (cpu = 0; cpu < ncpu; cpu++)
+    if (runqOf(cpu) == &ptable.runq[cpu])
+      readyListPromote(&ptable.runq[cpu]);
+  runqUnlockAll();
+}
+
+// Priority of p with any promotions since p->epoch applied.
+static uint
+curPriority(struct proc *p)
+{
+  uint missed = ptable.epoch - p->epoch;
+
+  if(missed >= MAXPRIO - p->priority)
+    return MAXPRIO;
+  return p->priority + missed;
+}
+
+// Fold pending promotions into p->priority. Caller must hold the
+// lock of p's run queue; the epoch only moves with all of them held.
+static void
+prioritySync(struct proc *p)
+{
+  p->priority = curPriority(p);
+  p->epoch = ptable.epoch;
+}
+
+// Sleep for n clock ticks. Rather than being woken on every tick
+// to recheck the time, the process parks on the timer wheel and
+// tickwakeup() wakes it once its deadline has passed.
+int
+ticksleep(int n)
+{
+  struct proc *p = myproc();
+
+  acquire(&ptable.lock);
+  p->deadline = ticks + n;
+  while((int)(p->deadline - ticks) > 0){
+    if(p->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+    timerAdd(p);
+    sleep(&p->deadline, &ptable.lock);
+    timerRemove(p);  // still queued if kill() woke us early
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+// Called on CPU 0 each time ticks advances, normally from the timer
+// interrupt. Everyone due is on the slots passed since the last call
+// (just the current one unless ticks jumped, see cpuIdle()); sleepers
+// due on a later turn of the wheel stay put. Periodic promotion is
+// driven from here too, off the scheduling path.
+void
+tickwakeup(void)
+{
+  struct proc **pp, *p;
+  uint now, t;
+
+  acquire(&ptable.lock);
+  now = ticks;
+  t = now - ptable.timerAt > NTIMERQ ? now - NTIMERQ : ptable.timerAt;
+  while(t != now){
+    t++;
+    for(pp = &ptable.timerq[t % NTIMERQ]; (p = *pp) != NULL;){
+      if((int)(p->deadline - now) <= 0){
+        *pp = p->tnext;
+        p->tnext = NULL;
+        wakeup1(&p->deadline);
+      } else
+        pp = &p->tnext;
+    }
+  }
+  ptable.timerAt = now;
+  if(now >= ptable.PromoteAtTime)
+    promote();
+  release(&ptable.lock);
+}
+
+#ifdef TICKLESS
+// Ticks until the earliest deadline on the wheel, looking at most one
+// turn ahead. Caller must hold ptable.lock.
+static uint
+timerNext(void)
+{
+  struct proc *p;
+  uint d;
+
+  for(d = 1; d < NTIMERQ; d++)
+    for(p = ptable.timerq[(ticks + d) % NTIMERQ]; p != NULL; p = p->tnext)
+      if(p->deadline - ticks <= d)
+        return d;
+  return NTIMERQ;
+}
+
+// Tickless idle: halt with the periodic tick stopped. CPU 0 keeps
+// time for everyone, so it only stops its tick once every CPU is
+// idle; it then sleeps until the next timer wheel deadline and on
+// waking credits ticks with the time that really passed. Other CPUs
+// sleep for up to IDLE_TICKS. An IPI from readyListKick() ends the
+// halt early when work is queued.
+static void
+cpuIdle(int me)
+{
+  struct runq *rq = &ptable.runq[me];
+  uint n = 0;
+  int cpu;
+
+  cli();
+  rq->idle = 1;
+  __sync_synchronize();
+  if(!readyListWaiting(me)){
+    if(me != 0)
+      n = IDLE_TICKS;
+    else {
+      for(cpu = 1; cpu < ncpu && ptable.runq[cpu].idle; cpu++)
+        ;
+      if(cpu == ncpu){
+        acquire(&ptable.lock);
+        n = timerNext();
+        release(&ptable.lock);
+      }
+    }
+    if(n > 0)
+      lapiconeshot(n);
+    stihlt();
+    cli();
+    if(n > 0){
+      n = lapicperiodic();
+      if(me == 0 && n > 0){
+        atom_add((int *)&ticks, n);
+        tickwakeup();
+      }
+    }
+  }
+  rq->idle = 0;
+  __sync_synchronize();
+  if(me != 0 && ptable.runq[0].idle)
+    kick(0);  // CPU 0 must be ticking while we are busy
+  sti();
+}
+
+// Interrupt CPU cpu out of cpuIdle(). Interrupts must be off.
+static void
+kick(int cpu)
+{
+  if(cpu != cpuid())
+    lapicwake(cpus[cpu].apicid);
+}
+
+// Work was queued on CPU cpu. Wake it if it is idle; if it is busy
+// and already has a backlog, wake an idle peer to steal from it.
+// Caller must hold the lock of the queue the work went on.
+static void
+readyListKick(int cpu)
+{
+  int i;
+
+  // Pairs with the barrier in cpuIdle(): make the work just queued
+  // visible before reading idle, or both sides can miss each other.
+  __sync_synchronize();
+  if(ptable.runq[cpu].idle){
+    kick(cpu);
+    return;
+  }
+#ifndef CS333_P6
+  if(ptable.runq[cpu].count < 2)
+    return;
+#endif
+  for(i = 0; i < ncpu; i++){
+    if(ptable.runq[i].idle){
+      kick(i);
+      return;
+    }
+  }
+}
+#endif // TICKLESS
+
+// Timer wheel insert and delete. Caller must hold ptable.lock.
+static void
+timerAdd(struct proc *p)
+{
+  struct proc **slot = &ptable.timerq[p->deadline % NTIMERQ];
+
+  p->tnext = *slot;
+  *slot = p;
+}
+
+static void
+timerRemove(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &ptable.timerq[p->deadline % NTIMERQ]; *pp != NULL; pp = &(*pp)->tnext){
+    if(*pp == p){
+      *pp = p->tnext;
+      p->tnext = NULL;
+      return;
+    }
+  }
+}
+
+// Wait-channel hash bucket for chan (Fibonacci hashing on the
+// address, so nearby channels spread across buckets).
+static struct ptrs*
+sleepList(void *chan)
+{
+  return &ptable.sleepq[((uint)chan * 2654435761U) >> (32 - SLEEPQ_BITS)];
+}
+
+// Pid index maintenance. Caller must hold ptable.lock.
+static void
+pidAdd(struct proc *p)
+{
+  struct proc **slot = &ptable.pidq[p->pid % NPIDQ];
+
+  p->pnext = *slot;
+  *slot = p;
+}
+
+static void
+pidRemove(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &ptable.pidq[p->pid % NPIDQ]; *pp != NULL; pp = &(*pp)->pnext){
+    if(*pp == p){
+      *pp = p->pnext;
+      p->pnext = NULL;
+      return;
+    }
+  }
+  panic("pidRemove: not indexed");
+}
+
+static struct proc*
+pidLookup(int pid)
+{
+  struct proc *p;
+
+  for(p = ptable.pidq[(uint)pid % NPIDQ]; p != NULL; p = p->pnext)
+    if(p->pid == pid)
+      return p;
+  return NULL;
+}
+
+// Lock and return the run queue p belongs to. p->cpu may be changed
+// by a thief until we hold the queue it names.
+static struct runq*
+procRunq(struct proc *p)
+{
+  struct runq *rq;
+
+  for(;;){
+    rq = runqOf(p->cpu);
+    acquire(&rq->lock);
+    if(rq == runqOf(p->cpu))
+      return rq;
+    release(&rq->lock);
+  }
+}
+
+// Lock every run queue, in CPU order. Caller must hold ptable.lock.
+static void
+runqLockAll(void)
+{
+  int cpu;
+
+  for(cpu = 0; cpu < ncpu; cpu++)
+    if(runqOf(cpu) == &ptable.runq[cpu])
+      acquire(&ptable.runq[cpu].lock);
+}
+
+static void
+runqUnlockAll(void)
+{
+  int cpu;
+
+  for(cpu = ncpu - 1; cpu >= 0; cpu--)
+    if(runqOf(cpu) == &ptable.runq[cpu])
+      release(&ptable.runq[cpu].lock);
+}
+
+// Make p, just taken off the sleep queues or the EMBRYO list,
+// RUNNABLE on its run queue. Caller must hold ptable.lock.
+static void
+readyListWake(struct proc *p)
+{
+  struct runq *rq = procRunq(p);
+
+  p->state = RUNNABLE;
+  readyListAdd(p);
+#ifdef CS333_P6
+  lotteryAdd(p);
+#endif
+  release(&rq->lock);
+}
+
+// Per-CPU ready list management. A RUNNABLE process is queued on
+// runqOf(p->cpu) at level p->priority. Caller must hold that
+// queue's lock.
+static void
+readyListAdd(struct proc *p)
+{
+  struct runq *rq = runqOf(p->cpu);
+
+  prioritySync(p);
+  stateListAdd(&rq->ready[p->priority], p);
+  rq->readymask[p->priority / 32] |= 1U << (p->priority % 32);
+  rq->count++;
+#if defined(TICKLESS) && !defined(CS333_P6)
+  readyListKick(p->cpu);
+#endif
+}
+
+static int
+readyListRemove(struct proc *p)
+{
+  struct runq *rq = runqOf(p->cpu);
+  int rc;
+
+  prioritySync(p);
+  rc = stateListRemove(&rq->ready[p->priority], p);
+  if(rc == 0){
+    if(rq->ready[p->priority].head == NULL)
+      rq->readymask[p->priority / 32] &= ~(1U << (p->priority % 32));
+    rq->count--;
+  }
+  return rc;
+}
+
+// Shift every ready list of rq up one level; the top level absorbs
+// the one below it. Used by promote().
+static void
+readyListPromote(struct runq *rq)
+{
+  struct ptrs *hi, *lo;
+  int i;
+
+  for (i = 0; i < NREADYMASK; i++)
+    rq->readymask[i] = 0;
+  for (i = MAXPRIO; i > 0; i--) {
+    hi = &rq->ready[i];
+    lo = &rq->ready[i-1];
+    if(i == MAXPRIO && hi->head != NULL){
+      if(lo->head != NULL){
+        hi->tail->next = lo->head;
+        hi->tail = lo->tail;
+      }
+    } else
+      *hi = *lo;
+    lo->head = NULL;
+    lo->tail = NULL;
+    if(hi->head != NULL)
+      rq->readymask[i / 32] |= 1U << (i % 32);
+  }
+  if(MAXPRIO == 0 && rq->ready[0].head != NULL)
+    rq->readymask[0] = 1;
+}
+
+#ifndef CS333_P6
+// Highest non-empty ready level of rq at or below level from, or -1.
+// At most two bitmap words for MAXPRIO up to 63, so this is O(1).
+static int
+readyLevel(struct runq *rq, int from)
+{
+  uint bits;
+  int w;
+
+  while(from >= 0){
+    w = from / 32;
+    bits = rq->readymask[w] & (~0U >> (31 - from % 32));
+    if(bits)
+      return w * 32 + bsrl(bits);
+    from = w * 32 - 1;
   }
+  return -1;
 }
+
+// Pick the busiest peer run queue to steal from, or -1 if every
+// peer is empty. Counts are read unlocked; a stale answer only
+// costs one wasted pass through the scheduler loop.
+static int
+readyListVictim(int me)
+{
+  int cpu, victim = -1, most = 0;
+
+  for(cpu = 0; cpu < ncpu; cpu++){
+    if(cpu != me && ptable.runq[cpu].count > most){
+      most = ptable.runq[cpu].count;
+      victim = cpu;
+    }
+  }
+  return victim;
+}
+#endif // !CS333_P6
+
+// Lock-free check whether the scheduler on CPU me has anything to
+// dispatch, so that idle CPUs can halt without taking a lock.
+static int
+readyListWaiting(int me)
+{
+  __sync_synchronize();  // reload the counts on every pass
+#ifdef CS333_P6
+  return ptable.totalTickets > 0;
+#else
+  return ptable.runq[me].count > 0 || readyListVictim(me) >= 0;
+#endif
+}
+
+#ifndef CS333_P6
+// Dequeue the highest-priority process from rq, or return NULL if it
+// is empty. Caller must hold rq->lock.
+static struct proc*
+readyListPop(struct runq *rq)
+{
+  struct proc *p = NULL;
+  int i;
+
+  if((i = readyLevel(rq, MAXPRIO)) >= 0){
+    p = rq->ready[i].head;
+    if(stateListRemove(&rq->ready[i], p) == -1)
+      panic("failed to remove from ready list in readyListPop()");
+    if(rq->ready[i].head == NULL)
+      rq->readymask[i / 32] &= ~(1U << (i % 32));
+    rq->count--;
+  }
+  if(p != NULL)
+    prioritySync(p);
+  return p;
+}
+
+// CPU me found its own queue empty: take the highest-priority
+// process from the busiest peer and make it ours. Returns with our
+// queue locked, and NULL if there was nothing to take. Must not be
+// called holding any run queue lock.
+static struct proc*
+readyListSteal(int me)
+{
+  struct runq *rq = &ptable.runq[me], *vq;
+  struct proc *p;
+  int victim;
+
+  if((victim = readyListVictim(me)) < 0){
+    acquire(&rq->lock);
+    return NULL;
+  }
+  vq = &ptable.runq[victim];
+  acquire(victim < me ? &vq->lock : &rq->lock);
+  acquire(victim < me ? &rq->lock : &vq->lock);
+  // Work may have been queued on our own queue meanwhile.
+  if((p = readyListPop(rq)) == NULL && (p = readyListPop(vq)) != NULL)
+    p->cpu = me;
+  release(&vq->lock);
+  return p;
+}
+#endif // !CS333_P6
 #endif // CS333_P4
 
+#ifdef CS333_P6
+int
+settickets(int pid, int tickets)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  if((p = pidLookup(pid)) == NULL){
+    release(&ptable.lock);
+    return -1; //invalid pid
+  }
+  // A RUNNABLE process is in the tree; reweigh it in place.
+  acquire(&runqOf(0)->lock);
+  if(p->state == RUNNABLE)
+    lotteryRemove(p);
+  p->tickets = tickets;
+  if(p->state == RUNNABLE)
+    lotteryAdd(p);
+  release(&runqOf(0)->lock);
+  release(&ptable.lock);
+  return 0;
+}
+
+int
+gettickets(int pid)
+{
+  struct proc *p;
+  int tickets = -1;
+
+  acquire(&ptable.lock);
+  if((p = pidLookup(pid)) != NULL)
+    tickets = p->tickets;
+  release(&ptable.lock);
+  return tickets;
+}
+
+// Lottery support. ptable.tickets is a Fenwick (binary indexed) tree
+// over the proc array: slot i+1 holds the tickets of ptable.proc[i]
+// while it is RUNNABLE and 0 otherwise, so both updating a weight and
+// drawing a winner are O(log NPROC). Callers must hold the shared run
+// queue lock, runqOf(0)->lock.
+static void
+lotteryUpdate(struct proc *p, int delta)
+{
+  int i;
+
+  for(i = (p - ptable.proc) + 1; i <= NPROC; i += i & -i)
+    ptable.tickets[i] += delta;
+  ptable.totalTickets += delta;
+}
+
+static void
+lotteryAdd(struct proc *p)
+{
+  lotteryUpdate(p, p->tickets);
+#ifdef TICKLESS
+  readyListKick(p->cpu);  // only now visible to readyListWaiting()
+#endif
+}
+
+static void
+lotteryRemove(struct proc *p)
+{
+  lotteryUpdate(p, -p->tickets);
+}
+
+// Draw a ticket and return the RUNNABLE process holding it,
+// or NULL if nothing is runnable.
+static struct proc*
+lotteryWinner(void)
+{
+  int pos, step, draw;
+
+  if(ptable.totalTickets <= 0)
+    return NULL;
+
+  // xorshift32
+  ptable.seed ^= ptable.seed << 13;
+  ptable.seed ^= ptable.seed >> 17;
+  ptable.seed ^= ptable.seed << 5;
+  draw = ptable.seed % ptable.totalTickets;
+
+  // Descend the tree for the first slot whose prefix sum exceeds draw.
+  for(step = 1; (step << 1) <= NPROC; step <<= 1)
+    ;
+  for(pos = 0; step > 0; step >>= 1){
+    if(pos + step <= NPROC && ptable.tickets[pos + step] <= draw){
+      pos += step;
+      draw -= ptable.tickets[pos];
+    }
+  }
+  return &ptable.proc[pos];
+}
+#endif // CS333_P6
+
 #ifdef DEBUG
 static int
 procLookup(struct proc *p, struct proc *np)
@@ -1867,6 +2698,15 @@ findProc(struct proc *p)
 {
   for (int i=UNUSED; i<=ZOMBIE; i++)
     if (procLookup(p, ptable.list[i].head)   != 0) return 1;
+#ifdef CS333_P4
+  for (int i=0; i<NSLEEPQ; i++)
+    if (procLookup(p, ptable.sleepq[i].head) != 0) return 1;
+  for (int cpu=0; cpu<ncpu; cpu++)
+    for (int i=0; i<=MAXPRIO; i++)
+      if (procLookup(p, ptable.runq[cpu].ready[i].head) != 0) return 1;
+  for (int cpu=0; cpu<ncpu; cpu++)
+    if (cpus[cpu].proc == p && p->state == RUNNING) return 1;
+#endif
   return 0; // not found
 }
 
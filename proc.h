@@ -8,6 +8,9 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+#ifdef CS333_P4
+  struct proc *prev;           // Switched away from; see schedFinish()
+#endif
 };
 
 extern struct cpu cpus[NCPU];
@@ -31,6 +34,16 @@ struct context {
   uint eip;
 };
 
+// An ELF segment that exec() left to be paged in on demand: the
+// pages of [va, va+memsz) are read from the executable at off the
+// first time they are touched, and bytes past filesz are zero.
+struct vmseg {
+  uint va;
+  uint memsz;
+  uint off;
+  uint filesz;
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -49,6 +62,11 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Executable, for demand paging
+  int logres;                  // Log blocks reserved by begin_opn()
+  int nseg;                    // Number of valid entries in seg
+  struct vmseg seg[NSEG];      // Segments still backed by exe
+  int largeheap;               // If non-zero, map heap with 4 MB pages
   char name[16];               // Process name (debugging)
   uint start_ticks;
   uint cpu_ticks_total; //total elapsed ticks in CPU
@@ -59,6 +77,17 @@ struct proc {
 #ifdef CS333_P4
   uint priority;
   int budget;
+  uint epoch;                  // ptable.epoch when priority was last synced
+  int cpu;                     // run queue this process is on or last ran on
+  int oncpu;                   // kernel stack or page table still in use
+  uint deadline;               // ticksleep() wake-up time
+  struct proc *tnext;          // next on the same timer wheel slot
+  struct proc *pnext;          // next on the same pid hash chain
+  struct proc *children;       // head of this process's child list
+  struct proc *sibling;        // next child of the same parent
+#endif
+#ifdef CS333_P6
+  uint tickets;                // lottery tickets held while RUNNABLE
 #endif
 };
 
@@ -27,7 +27,11 @@ main(int argc, char *argv[])
     exit();
   }
   
+#ifdef CS333_P6
+  printf(1,"\nPID\tName         UID\tGID\tPPID\tPrio\tTix\tElapsed\tCPU\tState\tSize\n");
+#else
   printf(1,"\nPID\tName         UID\tGID\tPPID\tPrio\tElapsed\tCPU\tState\tSize\n");
+#endif
   for(int i=0;i<table_size;i++){
     int s_elapsed_ticks = table[i].elapsed_ticks/1000;
     int ms_elapsed_ticks = table[i].elapsed_ticks%1000;
@@ -35,15 +39,18 @@ main(int argc, char *argv[])
     int s_cpu_total_ticks =table[i].CPU_total_ticks/1000;
     int ms_cpu_total_ticks =table[i].CPU_total_ticks%1000;
  
-   printf(1,"%d\t%s\t     %d\t\t%d\t%d\t%d\t%d.",
+   printf(1,"%d\t%s\t     %d\t\t%d\t%d\t%d\t",
    table[i].pid,
    table[i].name,
    table[i].uid,
    table[i].gid,
    table[i].ppid,
-   table[i].priority,
-   s_elapsed_ticks
+   table[i].priority
    );
+#ifdef CS333_P6
+   printf(1,"%d\t", table[i].tickets);
+#endif
+   printf(1,"%d.", s_elapsed_ticks);
    if (ms_elapsed_ticks < 10)  printf(1,"0");
    if (ms_elapsed_ticks < 100) printf(1,"0");
    printf(1,"%d\t%d.",ms_elapsed_ticks,s_cpu_total_ticks);
@@ -51,6 +58,13 @@ main(int argc, char *argv[])
    if (ms_cpu_total_ticks < 100) printf(1,"0");
    printf(1,"%d\t%s\t%d\n",ms_cpu_total_ticks,table[i].state,table[i].size);
  }
+#ifdef CS333_P4
+  int quantum, budget;
+  printf(1,"\nPrio\tQuantum\tBudget\n");
+  for(int i=MAXPRIO;i>=0;i--)
+    if(getsched(i,&quantum,&budget)==0)
+      printf(1,"%d\t%d\t%d\n",i,quantum,budget);
+#endif
   free(table);
   exit();
 }
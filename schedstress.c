@@ -1,6 +1,7 @@
 #ifdef CS333_P4
 #include "types.h"
 #include "user.h"
+#include "pdx.h"
 
 // Noah Zentzis, 2016
 
@@ -201,6 +202,77 @@ test4(void) {
   printf(1, "\n> test 4 complete\n");
 }
 
+// Test 5: dispatch throughput. Starts NPAIRS pairs of processes that bounce a
+// byte back and forth over two pipes, so every round trip costs two sleeps,
+// two wakeups and two dispatches. Reports round trips per second; run it with
+// different CPUS= settings to see how scheduling throughput scales.
+#define NPAIRS 4
+#define ROUNDS 2000
+
+void
+pingpong(int rounds) {
+  int ping[2], pong[2];
+  char c = 0;
+
+  pipe(ping);
+  pipe(pong);
+  if(fork() == 0) {
+    for(int i = 0;i < rounds;i++) {
+      read(ping[0], &c, 1);
+      write(pong[1], &c, 1);
+    }
+    exit();
+  }
+  for(int i = 0;i < rounds;i++) {
+    write(ping[1], &c, 1);
+    read(pong[0], &c, 1);
+  }
+  waitall();
+  close(ping[0]);
+  close(ping[1]);
+  close(pong[0]);
+  close(pong[1]);
+}
+
+void
+test5(void) {
+  printf(1, "\n> starting test 5\n");
+
+  int start = uptime();
+  for(int i = 0;i < NPAIRS;i++) {
+    if(fork() == 0) {
+      pingpong(ROUNDS);
+      exit();
+    }
+  }
+  waitall();
+
+  int elapsed = uptime() - start;
+  if(elapsed == 0) elapsed = 1;
+  printf(1, "%d round trips in %d ticks: %d per second\n",
+      NPAIRS * ROUNDS, elapsed, NPAIRS * ROUNDS * TPS / elapsed);
+  printf(1, "\n> test 5 complete\n");
+}
+
+// Test 6: context switch cost. A single pair plays ping-pong, so each
+// round trip is two switches between address spaces with nothing else
+// to run. Reports switches per second; run it with CPUS=1 so the two
+// processes have to take turns on one CPU.
+#define SWITCHROUNDS 20000
+
+void
+test6(void) {
+  printf(1, "\n> starting test 6\n");
+
+  int start = uptime();
+  pingpong(SWITCHROUNDS);
+  int elapsed = uptime() - start;
+  if(elapsed == 0) elapsed = 1;
+  printf(1, "%d round trips in %d ticks: %d switches per second\n",
+      SWITCHROUNDS, elapsed, 2 * SWITCHROUNDS * TPS / elapsed);
+  printf(1, "\n> test 6 complete\n");
+}
+
 int
 main(int argc, char **argv) {
   int test = 0;
@@ -211,6 +283,8 @@ main(int argc, char **argv) {
   if(test == 2 || test == 0) test2();
   if(test == 3 || test == 0) test3();
   if(test == 4 || test == 0) test4();
+  if(test == 5 || test == 0) test5();
+  if(test == 6 || test == 0) test6();
   exit();
 }
 #endif
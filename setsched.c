@@ -0,0 +1,20 @@
+#ifdef CS333_P4
+#include "types.h"
+#include "user.h"
+
+int
+main(int argc, char *argv[])
+{
+  if(argc<4){
+    printf(2, "usage: setsched prio quantum budget\n");
+    exit();
+  }
+
+  int rc = setsched(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]));
+  if(rc == -1)
+    printf(2, "An error has occurred while setting the schedule\n");
+  else
+    printf(1, "Schedule set successfully\n");
+  exit();
+}
+#endif
@@ -0,0 +1,203 @@
+// Object caches for small, fixed-size kernel objects such as
+// pipes, open files and in-memory inodes. Each cache carves
+// pages from kalloc() into equal-sized objects, so a 600-byte
+// pipe no longer costs a whole page and the number of objects
+// is limited only by free memory.
+//
+// A slab is one page: a struct slab header followed by as many
+// objects as fit. Free objects in a slab are chained through
+// their first word. The cache keeps slabs that still have free
+// objects on a partial list; a slab whose objects are all in use
+// is off every list, and one that becomes empty goes back to
+// kalloc() unless it is the only slab left on the partial list.
+//
+// In front of the slabs each CPU has a small magazine of free
+// objects, used with interrupts off, so most allocations and
+// frees touch neither the cache lock nor a slab.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct slab {
+  struct slab *next;       // on cache's partial list
+  struct slab *prev;
+  struct slabcache *cache;
+  void *freelist;          // free objects in this slab
+  int inuse;               // objects allocated or in a magazine
+  int partial;             // on the partial list?
+};
+
+// All caches, for slabdump(). Caches are registered once while
+// the kernel starts and never removed, so the list needs no lock.
+static struct slabcache *slabs;
+
+static void
+slablink(struct slabcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+  s->partial = 1;
+}
+
+static void
+slabunlink(struct slabcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->partial = 0;
+}
+
+// Set up cache c for objects of the given size.
+void
+slabinit(struct slabcache *c, char *name, uint size)
+{
+  size = (size + 7) & ~7;  // keep objects 8-byte aligned
+  if(size < sizeof(void*) ||
+     size > PGSIZE - ((sizeof(struct slab) + 7) & ~7))
+    panic("slabinit");
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - ((sizeof(struct slab) + 7) & ~7)) / size;
+  c->partial = 0;
+  c->nslab = 0;
+  c->inuse = 0;
+  memset(c->mag, 0, sizeof(c->mag));
+  c->next = slabs;
+  slabs = c;
+}
+
+// Add a fresh slab to c. Caller must hold c->lock.
+static int
+slabgrow(struct slabcache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return -1;
+  s->cache = c;
+  s->inuse = 0;
+  s->freelist = 0;
+  obj = (char*)s + ((sizeof(struct slab) + 7) & ~7);
+  for(i = 0; i < c->perslab; i++, obj += c->size){
+    *(void**)obj = s->freelist;
+    s->freelist = obj;
+  }
+  slablink(c, s);
+  c->nslab++;
+  return 0;
+}
+
+// Take one object from c's slabs. Caller must hold c->lock.
+static void*
+slabget(struct slabcache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  if(c->partial == 0 && slabgrow(c) < 0)
+    return 0;
+  s = c->partial;
+  obj = s->freelist;
+  s->freelist = *(void**)obj;
+  if(++s->inuse == c->perslab)
+    slabunlink(c, s);
+  return obj;
+}
+
+// Return one object to its slab. Caller must hold c->lock.
+static void
+slabput(struct slabcache *c, void *obj)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)obj);
+  if(s->cache != c || s->inuse < 1)
+    panic("slabput");
+  *(void**)obj = s->freelist;
+  s->freelist = obj;
+  if(!s->partial)
+    slablink(c, s);
+  if(--s->inuse == 0 && c->partial->next != 0){
+    // Keep one empty slab around; give the rest back.
+    slabunlink(c, s);
+    c->nslab--;
+    kfree((char*)s);
+  }
+}
+
+// Allocate an object from c. The contents are undefined.
+// Returns 0 if memory is exhausted.
+void*
+slaballoc(struct slabcache *c)
+{
+  struct magazine *m;
+  void *obj;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < MAGSIZE/2 && (obj = slabget(c)) != 0)
+      m->obj[m->n++] = obj;
+    release(&c->lock);
+  }
+  obj = 0;
+  if(m->n > 0){
+    obj = m->obj[--m->n];
+    __sync_fetch_and_add(&c->inuse, 1);
+  }
+  popcli();
+  return obj;
+}
+
+// Free an object previously returned by slaballoc(c).
+void
+slabfree(struct slabcache *c, void *obj)
+{
+  struct magazine *m;
+
+#ifdef DEBUG
+  // Fill with junk to catch dangling refs.
+  memset(obj, 1, c->size);
+#endif
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2)
+      slabput(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  __sync_fetch_and_sub(&c->inuse, 1);
+  popcli();
+}
+
+// Print each cache's object size, live objects and slab
+// pages. Called from the console.
+void
+slabdump(void)
+{
+  struct slabcache *c;
+
+  cprintf("\nCache\tSize\tPer\tInuse\tSlabs\n");
+  for(c = slabs; c; c = c->next)
+    cprintf("%s\t%d\t%d\t%d\t%d\n", c->name, c->size, c->perslab,
+        c->inuse, c->nslab);
+}
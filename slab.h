@@ -0,0 +1,20 @@
+// Kernel object cache; see slab.c.
+
+#define MAGSIZE 16  // objects per CPU magazine
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct slabcache {
+  struct spinlock lock;
+  char *name;
+  uint size;                 // object size, rounded up
+  int perslab;               // objects per slab page
+  struct slab *partial;      // slabs with free objects
+  int nslab;                 // slab pages held
+  int inuse;                 // objects handed out
+  struct magazine mag[NCPU]; // per-CPU free objects
+  struct slabcache *next;    // all caches, for slabdump()
+};
@@ -54,7 +54,8 @@ argint(int n, int *ip)
 
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
+// lies within the process address space, and fault the block
+// in now so the kernel can use it while holding locks.
 int
 argptr(int n, char **pp, int size)
 {
@@ -65,6 +66,8 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  if(uvmfault(curproc, i, size) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -123,7 +126,15 @@ extern int sys_getprocs(void);
 #ifdef CS333_P4
 extern int sys_setpriority(void);
 extern int sys_getpriority(void);
+extern int sys_setsched(void);
+extern int sys_getsched(void);
+#endif
+
+#ifdef CS333_P6
+extern int sys_settickets(void);
+extern int sys_gettickets(void);
 #endif
+extern int sys_largeheap(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -166,7 +177,14 @@ static int (*syscalls[])(void) = {
 #ifdef CS333_P4
 [SYS_setpriority]    sys_setpriority,
 [SYS_getpriority]    sys_getpriority,
+[SYS_setsched]    sys_setsched,
+[SYS_getsched]    sys_getsched,
 #endif
+#ifdef CS333_P6
+[SYS_settickets]    sys_settickets,
+[SYS_gettickets]    sys_gettickets,
+#endif
+[SYS_largeheap]    sys_largeheap,
 
 };
 
@@ -210,7 +228,14 @@ static char *syscallnames[] = {
 #ifdef CS333_P4
   [SYS_setpriority]    "setpriority",
   [SYS_getpriority]    "getpriority",
+  [SYS_setsched]    "setsched",
+  [SYS_getsched]    "getsched",
+#endif
+#ifdef CS333_P6
+  [SYS_settickets]    "settickets",
+  [SYS_gettickets]    "gettickets",
 #endif
+  [SYS_largeheap]    "largeheap",
 };
 #endif // PRINT_SYSCALLS
 
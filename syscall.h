@@ -34,4 +34,12 @@
 
 #define SYS_setpriority  SYS_getprocs+1
 #define SYS_getpriority  SYS_setpriority+1
+
+#define SYS_settickets  SYS_getpriority+1
+#define SYS_gettickets  SYS_settickets+1
+
+#define SYS_setsched  SYS_gettickets+1
+#define SYS_getsched  SYS_setsched+1
+
+#define SYS_largeheap  SYS_getsched+1
 // student system calls begin here. Follow the existing pattern.
@@ -61,14 +61,33 @@ sys_sbrk(void)
   return addr;
 }
 
+// Ask for (on != 0) or stop asking for 4 MB pages backing any
+// whole, aligned 4 MB stretch of heap touched from now on.
+// Cleared by exec().
+int
+sys_largeheap(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  myproc()->largeheap = (on != 0);
+  return 0;
+}
+
 int
 sys_sleep(void)
 {
   int n;
+#ifndef CS333_P4
   uint ticks0;
+#endif
 
   if(argint(0, &n) < 0)
     return -1;
+#ifdef CS333_P4
+  return ticksleep(n);
+#else
   ticks0 = ticks;
   while(ticks - ticks0 < n){
     if(myproc()->killed){
@@ -77,6 +96,7 @@ sys_sleep(void)
     sleep(&ticks, (struct spinlock *)0);
   }
   return 0;
+#endif
 }
 
 // return how many clock tick interrupts have occurred
@@ -185,4 +205,53 @@ sys_getpriority(void){
   return getpriority(pid);
 }
 
+int
+sys_setsched(void){
+  int prio, quantum, budget;
+  if(argint(0, &prio) < 0 || argint(1, &quantum) < 0 || argint(2, &budget) < 0)
+    return -1;
+
+  if(prio < 0 || prio > MAXPRIO || quantum < 1 || budget < 1)
+    return -1;
+
+  return setsched(prio, quantum, budget);
+}
+int
+sys_getsched(void){
+  int prio;
+  int *quantum, *budget;
+  if(argint(0, &prio) < 0 || argptr(1, (void*)&quantum, sizeof(int)) < 0 ||
+      argptr(2, (void*)&budget, sizeof(int)) < 0)
+    return -1;
+
+  if(prio < 0 || prio > MAXPRIO)
+    return -1;
+
+  return getsched(prio, quantum, budget);
+}
+
+#endif
+#ifdef CS333_P6
+
+int
+sys_settickets(void){
+  int pid;
+  int tickets;
+  if(argint(0, &pid) < 0 || argint(1, &tickets) < 0)
+    return -1;
+
+  if(tickets < 1 || tickets > MAXTICKETS)
+    return -1;
+
+  return settickets(pid, tickets);
+}
+int
+sys_gettickets(void){
+  int pid;
+  if(argint(0, &pid) < 0)
+    return -1;
+
+  return gettickets(pid);
+}
+
 #endif
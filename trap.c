@@ -56,10 +56,19 @@ trap(struct trapframe *tf)
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
+#ifdef TICKLESS
+    // A one-shot on idle CPU 0 is accounted for by cpuIdle().
+    if(cpuid() == 0 && !lapictickless()){
+#else
     if(cpuid() == 0){
+#endif // TICKLESS
 #ifdef PDX_XV6
       atom_inc((int *)&ticks);
+#ifdef CS333_P4
+      tickwakeup();
+#else
       wakeup(&ticks);
+#endif // CS333_P4
 #else
       acquire(&tickslock);
       ticks++;
@@ -69,6 +78,12 @@ trap(struct trapframe *tf)
     }
     lapiceoi();
     break;
+#ifdef TICKLESS
+  case T_IRQ0 + IRQ_WAKE:
+    // Nothing to do; the idle CPU rechecks its run queue.
+    lapiceoi();
+    break;
+#endif // TICKLESS
   case T_IRQ0 + IRQ_IDE:
     ideintr();
     lapiceoi();
@@ -91,6 +106,14 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // Untouched program or heap page, or write to a copy-on-write
+    // page, from user space or from the kernel on behalf of a
+    // system call.
+    if(myproc() != 0 && pagefault(myproc(), rcr2(), tf->err) == 0)
+      break;
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -116,7 +139,9 @@ trap(struct trapframe *tf)
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
-#ifdef PDX_XV6
+#ifdef CS333_P4
+    tf->trapno == T_IRQ0+IRQ_TIMER && quantumexpired(myproc()))
+#elif defined(PDX_XV6)
     tf->trapno == T_IRQ0+IRQ_TIMER && ticks%SCHED_INTERVAL==0)
 #else
     tf->trapno == T_IRQ0+IRQ_TIMER)
@@ -34,5 +34,6 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_WAKE        30   // IPI: kick an idle CPU (TICKLESS)
 #define IRQ_SPURIOUS    31
 
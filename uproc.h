@@ -10,6 +10,9 @@ struct uproc {
 #ifdef CS333_P4
   uint priority;
 #endif // CS333_P4
+#ifdef CS333_P6
+  uint tickets;
+#endif // CS333_P6
   uint elapsed_ticks;
   uint CPU_total_ticks;
   char state[STRMAX];
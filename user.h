@@ -39,7 +39,14 @@ int getprocs(uint max, struct uproc* table) ;
 #ifdef CS333_P4
 int setpriority(int, int); //set priority
 int getpriority(int); //get priority
+int setsched(int, int, int); //set quantum and budget for a priority
+int getsched(int, int*, int*); //get quantum and budget for a priority
 #endif
+#ifdef CS333_P6
+int settickets(int, int); //set lottery tickets
+int gettickets(int); //get lottery tickets
+#endif
+int largeheap(int); //back the heap with 4 MB pages
 
 // ulib.c
 int stat(char*, struct stat*);
@@ -7,6 +7,7 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "mmu.h"
 
 char buf[8192];
 char name[3];
@@ -1559,6 +1560,69 @@ validateint(int *p)
       "ebx");
 }
 
+// Heap backed by 4 MB pages: shrinking into the middle of one
+// and growing again must give back zeroed memory, and fork must
+// copy it.
+void
+largeheaptest(void)
+{
+  char *oldbrk, *a, *p;
+  int pid;
+
+  printf(stdout, "largeheap test\n");
+  largeheap(1);
+  oldbrk = sbrk(0);
+  a = (char*)LPGROUNDUP((uint)oldbrk);
+  if(sbrk(a + LPGSIZE - oldbrk) == (char*)-1){
+    printf(stdout, "largeheap test: sbrk failed\n");
+    exit();
+  }
+  for(p = a; p < a + LPGSIZE; p += PGSIZE)
+    *p = 1;
+
+  sbrk(-(LPGSIZE/2));
+  sbrk(LPGSIZE/2);
+  if(a[0] != 1){
+    printf(stdout, "largeheap test: lost data below break\n");
+    exit();
+  }
+  for(p = a + LPGSIZE/2; p < a + LPGSIZE; p += PGSIZE){
+    if(*p != 0){
+      printf(stdout, "largeheap test: stale data at %x\n", p);
+      exit();
+    }
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "largeheap test: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(a[0] != 1 || a[LPGSIZE-1] != 0){
+      printf(stdout, "largeheap test: bad copy in child\n");
+      exit();
+    }
+    a[0] = 2;
+    exit();
+  }
+  wait();
+  if(a[0] != 1){
+    printf(stdout, "largeheap test: child wrote parent's heap\n");
+    exit();
+  }
+
+  sbrk(-(a + LPGSIZE - oldbrk));
+  sbrk(a + LPGSIZE - oldbrk);
+  if(a[0] != 0){
+    printf(stdout, "largeheap test: stale data after regrow\n");
+    exit();
+  }
+  sbrk(-(a + LPGSIZE - oldbrk));
+  largeheap(0);
+  printf(stdout, "largeheap test OK\n");
+}
+
 void
 validatetest(void)
 {
@@ -1768,6 +1832,7 @@ main(int argc, char *argv[])
   bigargtest();
   bsstest();
   sbrktest();
+  largeheaptest();
   validatetest();
 
   opentest();
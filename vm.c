@@ -31,7 +31,8 @@ seginit(void)
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages. If va is mapped by a
+// 4 MB page, return its PDE, which has PTE_PS set.
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -39,6 +40,8 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return pde;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
@@ -85,7 +88,8 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // page protection bits prevent user code from using the kernel's
 // mappings.
 //
-// setupkvm() and exec() set up every page table like this:
+// kvmalloc() builds kpgdir, and setupkvm() gives every other page
+// table a copy of its kernel half, like this:
 //
 //   0..KERNBASE: user memory (text+data+stack+heap), mapped to
 //                phys memory allocated by the kernel
@@ -99,6 +103,11 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // The kernel allocates physical memory for its heap and for user memory
 // between V2P(end) and the end of physical memory (PHYSTOP)
 // (directly addressable from end..P2V(PHYSTOP)).
+//
+// Everything from KERNBASE+4MB up is mapped with 4 MB PTE_PS pages,
+// so the whole kernel half needs a single page table page, for the
+// first 4 MB where the kernel text must stay read-only. All page
+// tables share that page; freevm() never frees it.
 
 // This table defines the kernel's mappings, which are present in
 // every process's page table.
@@ -114,24 +123,44 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
+// Map size bytes at va to pa for the kernel, with a 4 MB page
+// wherever va and pa are both 4 MB aligned and a whole one fits.
+// Kernel mappings are the same in every page table and never
+// change, so they are global: CR3 reloads leave them in the TLB.
+static int
+kvmmap(pde_t *pgdir, char *va, uint size, uint pa, int perm)
+{
+  perm |= PTE_G;
+  while(size > 0){
+    if((uint)va % LPGSIZE == 0 && pa % LPGSIZE == 0 && size >= LPGSIZE){
+      if(pgdir[PDX(va)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(va)] = pa | perm | PTE_PS | PTE_P;
+      va += LPGSIZE;
+      pa += LPGSIZE;
+      size -= LPGSIZE;
+    } else {
+      if(mappages(pgdir, va, PGSIZE, pa, perm) < 0)
+        return -1;
+      va += PGSIZE;
+      pa += PGSIZE;
+      size -= PGSIZE;
+    }
+  }
+  return 0;
+}
+
 // Set up kernel part of a page table.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
   if((pgdir = (pde_t*)kalloc()) == 0)
     return 0;
   memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
@@ -140,7 +169,17 @@ setupkvm(void)
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if((kpgdir = (pde_t*)kalloc()) == 0)
+    panic("kvmalloc");
+  memset(kpgdir, 0, PGSIZE);
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(kvmmap(kpgdir, k->virt, k->phys_end - k->phys_start,
+              (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
@@ -192,26 +231,31 @@ inituvm(pde_t *pgdir, char *init, uint sz)
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
+// Return the page that backs user address va in p's executable,
+// shared through the page cache, or 0 if va holds no file data:
+// pages outside every segment, and the tail of a segment past its
+// file data, are plain zero-fill. May sleep, so it must not be
+// reached with a spinlock held; see uvmfault().
+static char*
+loadpage(struct proc *p, uint va, int *err)
 {
-  uint i, pa, n;
-  pte_t *pte;
+  struct vmseg *s;
+  uint off, n;
+  char *mem;
 
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
+  *err = 0;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    if(va < s->va || va - s->va >= s->memsz)
+      continue;
+    off = va - s->va;
+    if(off >= s->filesz)
+      return 0;
+    n = s->filesz - off;
+    if(n > PGSIZE)
       n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
+    if((mem = pcacheget(p->exe, s->off + off, n)) == 0)
+      *err = -1;
+    return mem;
   }
   return 0;
 }
@@ -266,7 +310,22 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-    else if((*pte & PTE_P) != 0){
+    else if(*pte & PTE_PS){
+      // A large heap page goes once none of it is left in use.
+      // Until then, zero the part given back, so that growing
+      // the heap over it again yields zeroed memory.
+      if(LPGROUNDDOWN(a) >= newsz){
+        kfreepages(P2V(PTE_ADDR(*pte)), LPGORDER);
+        *pte = 0;
+      } else {
+        pa = PTE_ADDR(*pte) + (a - LPGROUNDDOWN(a));
+        if(oldsz > LPGROUNDUP(newsz))
+          memset(P2V(pa), 0, LPGROUNDUP(newsz) - a);
+        else
+          memset(P2V(pa), 0, oldsz - a);
+      }
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    } else if((*pte & PTE_P) != 0){
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
@@ -279,7 +338,7 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part. The kernel part is shared; see kvmalloc().
 void
 freevm(pde_t *pgdir)
 {
@@ -288,7 +347,7 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -311,37 +370,157 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. Pages are shared rather than copied:
+// writable ones become read-only PTE_COW in both page
+// tables and are copied by cowfault() on the first write.
+// pgdir must be the current page table.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
-  uint pa, i, flags;
+  uint pa, i;
   char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+      continue;  // heap page never touched; see growproc()
+    if(*pte & PTE_PS){
+      // Large heap pages have no reference count; copy now.
+      if((mem = kallocpages(LPGORDER)) == 0)
+        goto bad;
+      memmove(mem, P2V(PTE_ADDR(*pte)), LPGSIZE);
+      d[PDX(i)] = V2P(mem) | PTE_FLAGS(*pte);
+      i += LPGSIZE - PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0)
+    if(mappages(d, (void*)i, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
       goto bad;
+    kref(P2V(pa));
   }
+  lcr3(V2P(pgdir));  // parent's write permissions just went away
   return d;
 
 bad:
+  lcr3(V2P(pgdir));
   freevm(d);
   return 0;
 }
 
+// Map the whole 4 MB region around heap address va with a single
+// large page, if p asked for that with largeheap(), the region lies
+// inside p and nothing in it is mapped or backed by the executable.
+// Returns -1 if a small page should be used instead.
+static int
+largefault(struct proc *p, uint va)
+{
+  struct vmseg *s;
+  uint a;
+  char *mem;
+
+  a = LPGROUNDDOWN(va);
+  if(!p->largeheap || a + LPGSIZE > p->sz || a + LPGSIZE > KERNBASE ||
+     (p->pgdir[PDX(a)] & PTE_P))
+    return -1;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++)
+    if(s->va < a + LPGSIZE && a < s->va + s->memsz)
+      return -1;
+  if((mem = kallocpages(LPGORDER)) == 0)
+    return -1;
+  memset(mem, 0, LPGSIZE);
+  p->pgdir[PDX(a)] = V2P(mem) | PTE_PS | PTE_W | PTE_U | PTE_P;
+  return 0;
+}
+
+// Handle a page fault at va in process p. Program pages come
+// from the executable on first touch (see exec()) and are mapped
+// copy-on-write from the page cache, so every process running a
+// binary shares its text. Heap pages are mapped zero-filled (see
+// growproc()), 4 MB at a time for processes that asked for it,
+// and writes to copy-on-write pages go to cowfault().
+// Returns -1 if the access was not legal.
+int
+pagefault(struct proc *p, uint va, uint err)
+{
+  char *mem;
+  int perm, r;
+
+  if(err & FEC_PR)
+    return (err & FEC_WR) ? cowfault(p->pgdir, va) : -1;
+  if(va >= p->sz || va >= KERNBASE)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((mem = loadpage(p, va, &r)) != 0)
+    perm = PTE_COW|PTE_U;
+  else if(r == 0 && largefault(p, va) == 0)
+    return 0;
+  else if(r == 0 && (mem = kalloc()) != 0){
+    memset(mem, 0, PGSIZE);
+    perm = PTE_W|PTE_U;
+  } else
+    return -1;
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Make sure the user pages in [va, va+len) are present in p,
+// faulting in any that are not. System calls use this on user
+// buffers before taking locks, since pipewrite() and friends
+// touch user memory with a spinlock held and loading a page
+// from the executable may sleep.
+int
+uvmfault(struct proc *p, uint va, uint len)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if((pte == 0 || (*pte & PTE_P) == 0) && pagefault(p, a, 0) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Handle a write fault on a copy-on-write page at va: give
+// the faulting page table its own writable copy, or just
+// make the page writable again if nobody else shares it.
+// Returns -1 if va is not a copy-on-write page or memory
+// is exhausted.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem, *old;
+
+  if(va >= KERNBASE)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW))
+    return -1;
+  old = P2V(PTE_ADDR(*pte));
+  if(krefcount(old) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, old, PGSIZE);
+    *pte = V2P(mem) | PTE_FLAGS(*pte);
+    kfree(old);
+  }
+  *pte = (*pte & ~PTE_COW) | PTE_W;
+  invlpg((void*)va);
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -354,6 +533,8 @@ uva2ka(pde_t *pgdir, char *uva)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
+  if(*pte & PTE_PS)
+    return (char*)P2V(PTE_ADDR(*pte) + PGROUNDDOWN((uint)uva % LPGSIZE));
   return (char*)P2V(PTE_ADDR(*pte));
 }
 
@@ -365,10 +546,14 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_COW) && cowfault(pgdir, va0) < 0)
+      return -1;  // shared page: break the share before writing
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
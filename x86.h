@@ -134,6 +134,15 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Index of the most significant set bit. x must be non-zero.
+static inline uint
+bsrl(uint x)
+{
+  uint r;
+  asm("bsrl %1,%0" : "=r" (r) : "rm" (x) : "cc");
+  return r;
+}
+
 static inline uint
 rcr2(void)
 {
@@ -148,6 +157,12 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline void
+invlpg(void *addr)
+{
+  asm volatile("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().